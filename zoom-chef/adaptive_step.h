@@ -0,0 +1,127 @@
+#ifndef _ADAPTIVE_STEP_H
+#define _ADAPTIVE_STEP_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+// Step size of the simulation loop. Every loop iteration owes the physics some
+// simulated time (the wall clock delta, or the fixed lockstep step) and pays it
+// in steps of dt(), at one of three levels:
+//
+//   fine     a food touches something with more than contact_force, the net
+//            contact force of the spatula changes by more than contact_force
+//            between two iterations, or a joint of the robot or of a food
+//            moves faster than speed
+//   contact  an awake food touches something (the spatula sliding under the
+//            patty, a food landing on the grill or the stack), or the net
+//            contact force of the spatula changes by more than load_change
+//   coarse   nothing of that, e.g. the robot driving between the stations
+//
+// The spatula is held or rests on the counter all the time, so its steady
+// contacts would keep the loop off the coarse level for good, only changes of
+// its load count. dynamics3d does not report penetration depth, a large
+// contact force is what a deep penetration looks like. Sleeping foods (body_sleep.h) are not checked,
+// one that gets hit wakes up and is seen at its next step. A level is held for
+// hold seconds of simulated time after it was last needed, so a food bouncing
+// off the grill does not get coarse steps between bounces.
+enum { STEP_COARSE, STEP_CONTACT, STEP_FINE, NUM_STEP_LEVELS };
+
+struct AdaptiveStepParams
+{
+	double dt[NUM_STEP_LEVELS] = {0.001, 0.0005, 0.00025};  // s, coarse, contact, fine
+	double contact_force = 5;  // N on one contact point
+	double load_change = 1;    // N of change of the spatula's net contact force per iteration
+	double speed = 0.5;        // m/s and rad/s
+	double hold = 0.05;        // s
+	int max_steps = 16;        // per iteration, simulated time owed beyond is dropped
+};
+
+class AdaptiveStep
+{
+public:
+	int level() const { return _level; }
+	double dt(const AdaptiveStepParams& params) const { return params.dt[_level]; }
+
+	// what the last step found: whether an awake food has contacts or the
+	// spatula load changed, the largest contact force or load change and the
+	// largest joint speed. dt is the
+	// simulated time it covered
+	void observe(bool contact, double max_contact_force, double max_speed, double dt,
+				 const AdaptiveStepParams& params)
+	{
+		int level = STEP_COARSE;
+		if (max_contact_force > params.contact_force || max_speed > params.speed)
+			level = STEP_FINE;
+		else if (contact)
+			level = STEP_CONTACT;
+
+		if (level >= _level)
+		{
+			_level = level;
+			_held = 0;
+		}
+		else if ((_held += dt) >= params.hold)
+		{
+			_level = level;
+			_held = 0;
+		}
+	}
+
+	// steps of dt() taken at the current level
+	void count(int steps, double dt)
+	{
+		_steps[_level] += steps;
+		_time[_level] += steps * dt;
+	}
+
+	// owed time that was not simulated because of max_steps
+	void drop(double time) { _dropped += time; }
+
+	void print(const AdaptiveStepParams& params) const
+	{
+		const char* names[NUM_STEP_LEVELS] = {"coarse", "contact", "fine"};
+		unsigned long long steps = 0;
+		double time = 0;
+		for (int i = 0; i < NUM_STEP_LEVELS; i++)
+		{
+			steps += _steps[i];
+			time += _time[i];
+		}
+		printf("Physics steps             : %llu, %.0f per simulated second\n", steps, time > 0 ? steps / time : 0.0);
+		for (int i = NUM_STEP_LEVELS - 1; i >= 0; i--)
+			printf("  %-7s %6.3f ms         : %llu steps, %.1f %% of simulated time\n", names[i], 1e3 * params.dt[i],
+				   _steps[i], time > 0 ? 100 * _time[i] / time : 0.0);
+		if (_dropped > 0)
+			printf("Simulated time dropped    : %.3f s (more than %d steps owed)\n", _dropped, params.max_steps);
+	}
+
+private:
+	int _level = STEP_FINE;  // until the first step has been looked at
+	double _held = 0;
+	unsigned long long _steps[NUM_STEP_LEVELS] = {0, 0, 0};
+	double _time[NUM_STEP_LEVELS] = {0, 0, 0};
+	double _dropped = 0;
+};
+
+// step sizes in ms from ZOOM_CHEF_STEP_DT, "coarse,contact,fine", e.g.
+// "1,0.5,0.25". a single value is a fixed step
+inline AdaptiveStepParams adaptiveStepParamsFromEnv(const char* variable)
+{
+	AdaptiveStepParams params;
+	const char* value = getenv(variable);
+	if (value == nullptr || std::string(value).empty())
+		return params;
+	std::stringstream values(value);
+	std::string dt;
+	int level = 0;
+	while (level < NUM_STEP_LEVELS && getline(values, dt, ','))
+		if (atof(dt.c_str()) > 0)
+			params.dt[level++] = 1e-3 * atof(dt.c_str());
+	for (int i = level; i > 0 && i < NUM_STEP_LEVELS; i++)
+		params.dt[i] = params.dt[i - 1];
+	return params;
+}
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef _ALLOC_COUNTER_H
+#define _ALLOC_COUNTER_H
+
+#include <cstdlib>
+#include <malloc.h>
+#include <iostream>
+
+// Counts heap allocations inside the controller tick. The steady state tick
+// must not allocate: allocator calls are a source of jitter in the 1 kHz loop.
+//
+// Built with USING_ALLOC_COUNTER (cmake -DZOOM_CHEF_ALLOC_COUNT=ON) this file
+// replaces malloc and friends (operator new goes through malloc) with versions
+// that count calls made by the thread between begin() and end(). With
+// USING_ALLOC_ASSERT (cmake -DZOOM_CHEF_ALLOC_ASSERT=ON) the first allocation
+// after the warm-up ticks aborts the controller, so a regression fails the run.
+// Without either option TickAllocCounter does nothing.
+//
+// Replaces the glibc allocator entry points, include it from one translation
+// unit only.
+
+#ifdef USING_ALLOC_COUNTER
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t num, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+}
+
+static __thread bool alloc_counter_armed = false;
+static __thread unsigned long long alloc_counter_count = 0;
+
+extern "C" void* malloc(size_t size) throw()
+{
+	if (alloc_counter_armed)
+		alloc_counter_count++;
+	return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t num, size_t size) throw()
+{
+	if (alloc_counter_armed)
+		alloc_counter_count++;
+	return __libc_calloc(num, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) throw()
+{
+	if (alloc_counter_armed)
+		alloc_counter_count++;
+	return __libc_realloc(ptr, size);
+}
+
+extern "C" void* memalign(size_t alignment, size_t size) throw()
+{
+	if (alloc_counter_armed)
+		alloc_counter_count++;
+	return __libc_memalign(alignment, size);
+}
+
+extern "C" void* aligned_alloc(size_t alignment, size_t size) throw()
+{
+	if (alloc_counter_armed)
+		alloc_counter_count++;
+	return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void** ptr, size_t alignment, size_t size) throw()
+{
+	if (alloc_counter_armed)
+		alloc_counter_count++;
+	*ptr = __libc_memalign(alignment, size);
+	return *ptr == nullptr ? 12 /* ENOMEM */ : 0;
+}
+
+#endif
+
+class TickAllocCounter
+{
+public:
+	// ticks before warmup_ticks are not counted, caches and buffers fill up there
+	TickAllocCounter(unsigned long long warmup_ticks) : _warmup_ticks(warmup_ticks) {}
+
+	void begin()
+	{
+#ifdef USING_ALLOC_COUNTER
+		alloc_counter_count = 0;
+		alloc_counter_armed = true;
+#endif
+	}
+
+	void end()
+	{
+#ifdef USING_ALLOC_COUNTER
+		alloc_counter_armed = false;
+		unsigned long long count = alloc_counter_count;
+		if (_ticks++ < _warmup_ticks)
+			return;
+		_counted_ticks++;
+		if (count == 0)
+			return;
+		_ticks_with_allocations++;
+		_allocations += count;
+		if (count > _max_allocations)
+			_max_allocations = count;
+#ifdef USING_ALLOC_ASSERT
+		std::cerr << "Controller tick " << _ticks - 1 << " allocated " << count << " times after warm-up" << std::endl;
+		abort();
+#endif
+#endif
+	}
+
+	void print() const
+	{
+#ifdef USING_ALLOC_COUNTER
+		std::cout << "Tick allocations          : " << _allocations << " in " << _ticks_with_allocations << " of "
+				  << _counted_ticks << " ticks, max " << _max_allocations << " per tick\n";
+#endif
+	}
+
+private:
+	unsigned long long _warmup_ticks;
+	unsigned long long _ticks = 0;
+	unsigned long long _counted_ticks = 0;
+	unsigned long long _ticks_with_allocations = 0;
+	unsigned long long _allocations = 0;
+	unsigned long long _max_allocations = 0;
+};
+
+#endif
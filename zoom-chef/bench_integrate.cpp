@@ -0,0 +1,126 @@
+// Benchmark of sim->integrate on the zoom-chef kitchen, to compare collision
+// meshes: with ZOOM_CHEF_COLLISION_HULLS the build installs the simplified
+// scene in resources/ and the original one in resources/full/.
+//
+//   cd bin/zoom-chef
+//   ./bench_integrate_zoom_chef [steps] [world files...]
+//
+// Without world files both scenes are run if they exist. Every run starts from
+// the initial state of the world file and holds the robot against gravity. The
+// burger is moved just above the spatula blade, so the spatula falls onto the
+// counter and the patty lands on it: the hulled spatula meshes are in contact
+// with the ground and the burger for most of the run. The mean number of
+// contacts on the spatula and the burger is printed next to the timings.
+
+#include "Sai2Model.h"
+#include "Sai2Simulation.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "body_sleep.h"
+#include "loop_stats.h"
+#include "scene.h"
+
+using namespace std;
+using namespace Eigen;
+
+const string robot_file = "./resources/mmp_panda.urdf";
+const string robot_name = "mmp_panda";
+const string spatula_name = "spatula";
+const double step_dt = 0.001;
+
+// spatula links: handle, center (the bent neck) and base (the blade)
+const vector<string> spatula_links = {"link6", "link7", "link8"};
+
+// burger base at 0.5 0.5 0.5 (world file). the spatula frame is at 0.5 0.4 0.5
+// with the blade centered on it, so the patty starts 2 cm above the blade
+const Vector3d burger_on_spatula(0.5, 0.4, 0.52);
+
+bool benchmark(const string& world_file, int steps)
+{
+	if (!ifstream(world_file))
+		return false;
+
+	auto sim = new Simulation::Sai2Simulation(world_file, false);
+	sim->setCollisionRestitution(0.1);
+	sim->setCoeffFrictionStatic(0.9);
+	sim->setCoeffFrictionDynamic(0.2);
+
+	auto robot = new Sai2Model::Sai2Model(robot_file, false);
+	VectorXd g(robot->dof());
+
+	FoodTable foods;
+	loadFoodTable(world_file, {robot_name, spatula_name}, foods);
+	int burger = foods.index("burger");
+	if (burger >= 0)
+	{
+		VectorXd q = VectorXd::Zero(6);
+		Vector3d shift = burger_on_spatula - foods.offsets.col(burger);
+		q << shift(2), shift(1), shift(0), 0, 0, 0;
+		sim->setJointPositions(foods.names[burger], q);
+	}
+
+	LatencyHistogram integrate;
+	double total_ns = 0;
+	vector<Vector3d> contact_points, contact_forces;
+	long spatula_contacts = 0, burger_contacts = 0;
+	for (int i = 0; i < steps; i++)
+	{
+		sim->getJointPositions(robot_name, robot->_q);
+		sim->getJointVelocities(robot_name, robot->_dq);
+		robot->updateModel();
+		robot->gravityVector(g);
+		sim->setJointTorques(robot_name, g);
+
+		auto start = chrono::steady_clock::now();
+		sim->integrate(step_dt);
+		int64_t ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+		integrate.record(ns);
+		total_ns += ns;
+
+		for (const string& link : spatula_links)
+		{
+			bodyContactForce(sim, spatula_name, link, contact_points, contact_forces);
+			spatula_contacts += contact_points.size();
+		}
+		if (burger >= 0)
+		{
+			bodyContactForce(sim, foods.names[burger], "link6", contact_points, contact_forces);
+			burger_contacts += contact_points.size();
+		}
+	}
+
+	printf("%-45s integrate us mean %.1f p50 %.1f p99 %.1f max %.1f (%d steps, %d foods)\n", world_file.c_str(),
+		   total_ns * 1e-3 / steps, integrate.quantile(0.5) * 1e-3, integrate.quantile(0.99) * 1e-3,
+		   integrate.max() * 1e-3, steps, foods.num_foods);
+	printf("%-45s contacts per step: spatula %.1f burger %.1f\n", "", (double) spatula_contacts / steps,
+		   (double) burger_contacts / steps);
+	delete robot;
+	delete sim;
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	int steps = argc > 1 ? atoi(argv[1]) : 3000;
+	vector<string> world_files;
+	for (int i = 2; i < argc; i++)
+		world_files.push_back(argv[i]);
+	if (world_files.empty())
+		world_files = {"./resources/full/world_panda_gripper.urdf", "./resources/world_panda_gripper.urdf"};
+
+	int runs = 0;
+	for (const string& world_file : world_files)
+		runs += benchmark(world_file, steps);
+	if (runs == 0)
+	{
+		cout << "No world file found, run from bin/zoom-chef" << endl;
+		return 1;
+	}
+	return 0;
+}
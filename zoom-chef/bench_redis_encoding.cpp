@@ -0,0 +1,58 @@
+// Microbenchmark of the two wire formats used on the hot redis keys: the JSON
+// text of RedisClient::encodeEigenMatrixJSON/decodeEigenMatrixJSON against the
+// binary format in redis_binary.h. Runs in-process, no redis server needed.
+
+#include "redis/RedisClient.h"
+#include "redis_binary.h"
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+using namespace std;
+using namespace Eigen;
+
+const int num_iterations = 100000;
+
+// keeps the optimizer from dropping the decoded values
+double sink = 0;
+
+template<typename Function>
+double nanosecondsPerCall(Function f)
+{
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < num_iterations; i++)
+		f();
+	auto end = chrono::steady_clock::now();
+	return chrono::duration<double, nano>(end - start).count() / num_iterations;
+}
+
+void benchmark(const string& name, const MatrixXd& value)
+{
+	string json = RedisClient::encodeEigenMatrixJSON(value);
+	string binary;
+	encodeEigenBinary(value, 0, binary);
+
+	MatrixXd json_decoded, binary_decoded(value.rows(), value.cols());
+
+	double json_encode = nanosecondsPerCall([&]() { json = RedisClient::encodeEigenMatrixJSON(value); });
+	double json_decode = nanosecondsPerCall([&]() { json_decoded = RedisClient::decodeEigenMatrixJSON(json); sink += json_decoded(0, 0); });
+	double binary_encode = nanosecondsPerCall([&]() { encodeEigenBinary(value, 1, binary); });
+	double binary_decode = nanosecondsPerCall([&]() { decodeEigenBinary(binary.data(), binary.size(), binary_decoded); sink += binary_decoded(0, 0); });
+
+	cout << setw(6) << name
+		 << " | json   " << setw(5) << json.size() << " B  encode " << setw(8) << json_encode << " ns  decode " << setw(8) << json_decode << " ns\n"
+		 << setw(6) << ""
+		 << " | binary " << setw(5) << binary.size() << " B  encode " << setw(8) << binary_encode << " ns  decode " << setw(8) << binary_decode << " ns\n";
+}
+
+int main() {
+	cout << fixed << setprecision(1);
+	cout << "Eigen wire format, " << num_iterations << " iterations per measurement\n";
+	benchmark("12x1", MatrixXd::Random(12, 1));
+	benchmark("3x3", MatrixXd::Random(3, 3));
+	benchmark("12x12", MatrixXd::Random(12, 12));
+	cout << "(checksum " << sink << ")\n";
+	return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef _BODY_POSE_H
+#define _BODY_POSE_H
+
+#include <string>
+
+#include <Eigen/Dense>
+
+// World pose of the kitchen objects (spatula.urdf, burger.urdf, ...) straight
+// from their joint positions. Every object is a free body built from three
+// prismatic joints along z, y and x followed by three revolute joints about x,
+// y and z, all with zero origins, so link6 sits at (q2, q1, q0) with rotation
+// Rx(q3) Ry(q4) Rz(q5) relative to the object base. This replaces a full
+// Sai2Model::updateModel() (mass matrix included) plus positionInWorld() per
+// object and step by a handful of flops.
+//
+// bodyPoseMatches() checks this against the Sai2Model of an object at a test
+// configuration, run it once at startup so a changed urdf does not go
+// unnoticed.
+
+inline void bodyPosition(const Eigen::VectorXd& q, const Eigen::Vector3d& base, Eigen::Vector3d& position)
+{
+	position << base(0) + q(2), base(1) + q(1), base(2) + q(0);
+}
+
+// positions of many bodies in one pass, column i from q.col(i) and base.col(i)
+inline void bodyPositions(const Eigen::Matrix<double, 6, Eigen::Dynamic>& q, const Eigen::Matrix3Xd& base,
+						  Eigen::Matrix3Xd& positions)
+{
+	positions.row(0) = base.row(0) + q.row(2);
+	positions.row(1) = base.row(1) + q.row(1);
+	positions.row(2) = base.row(2) + q.row(0);
+}
+
+inline void bodyRotation(const Eigen::VectorXd& q, Eigen::Matrix3d& rotation)
+{
+	rotation = (Eigen::AngleAxisd(q(3), Eigen::Vector3d::UnitX()) * Eigen::AngleAxisd(q(4), Eigen::Vector3d::UnitY()) *
+				Eigen::AngleAxisd(q(5), Eigen::Vector3d::UnitZ())).toRotationMatrix();
+}
+
+// compare with the kinematics of the object model at a test configuration.
+// leaves the model at that configuration
+template<typename Model>
+bool bodyPoseMatches(Model* model, const std::string& link, double tolerance = 1e-9)
+{
+	if (model->dof() != 6)
+		return false;
+	model->_q << 0.1, -0.2, 0.3, 0.4, -0.5, 0.6;
+	model->updateKinematics();
+	Eigen::Vector3d position, expected_position;
+	Eigen::Matrix3d rotation, expected_rotation;
+	bodyPosition(model->_q, Eigen::Vector3d::Zero(), position);
+	bodyRotation(model->_q, rotation);
+	model->positionInWorld(expected_position, link);
+	model->rotationInWorld(expected_rotation, link);
+	return (position - expected_position).norm() < tolerance && (rotation - expected_rotation).norm() < tolerance;
+}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef _BODY_SLEEP_H
+#define _BODY_SLEEP_H
+
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+#include "Sai2Simulation.h"
+
+// Sleep/wake bookkeeping of a passive body in the simulation loop. An awake
+// body is read back from the simulation every step. Once all its joint
+// velocities stayed below speed for dwell seconds it falls asleep: the loop
+// stops reading it and keeps publishing its last pose. The physics engine still
+// integrates it, so a sleeping body that gets pushed moves correctly, only its
+// published pose lags until it wakes up.
+//
+// A sleeping body wakes up
+//  - at once when a command torque is applied to it,
+//  - on contact: every poll_interval seconds the total contact force on the body
+//    is compared with the one it rested on when it fell asleep,
+//  - on motion: at the same poll its velocities are checked again.
+struct BodySleepParams
+{
+	double speed = 1e-3;         // m/s and rad/s
+	double dwell = 0.5;          // s below speed before sleeping
+	double poll_interval = 0.01; // s between wake checks while asleep
+	double wake_force = 0.2;     // N change of the contact force that wakes
+};
+
+class BodySleep
+{
+public:
+	bool asleep() const { return _asleep; }
+
+	// awake body, call every step with its velocities. returns true when the
+	// body fell asleep with this step
+	bool update(const Eigen::VectorXd& dq, double dt, const BodySleepParams& params)
+	{
+		if (dq.cwiseAbs().maxCoeff() > params.speed)
+		{
+			_still_time = 0;
+			return false;
+		}
+		_still_time += dt;
+		if (_still_time < params.dwell)
+			return false;
+		_asleep = true;
+		_poll_time = 0;
+		_sleeps++;
+		return true;
+	}
+
+	// asleep body, call every step. returns true when a wake check is due, the
+	// caller then reads velocities and contact force and calls pollWake()
+	bool pollDue(double dt, const BodySleepParams& params)
+	{
+		_steps_asleep++;
+		_poll_time += dt;
+		if (_poll_time < params.poll_interval)
+			return false;
+		_poll_time = 0;
+		return true;
+	}
+
+	// returns true (and wakes) if the body moves or its contact force changed
+	bool pollWake(const Eigen::VectorXd& dq, const Eigen::Vector3d& contact_force, const BodySleepParams& params)
+	{
+		if (dq.cwiseAbs().maxCoeff() > params.speed || (contact_force - _rest_force).norm() > params.wake_force)
+		{
+			wake();
+			return true;
+		}
+		return false;
+	}
+
+	// contact force the body rests on, set when it falls asleep
+	void setRestForce(const Eigen::Vector3d& contact_force) { _rest_force = contact_force; }
+
+	void wake()
+	{
+		if (_asleep)
+			_wakes++;
+		_asleep = false;
+		_still_time = 0;
+	}
+
+	unsigned long long stepsAsleep() const { return _steps_asleep; }
+	unsigned long long sleeps() const { return _sleeps; }
+	unsigned long long wakes() const { return _wakes; }
+
+private:
+	bool _asleep = false;
+	double _still_time = 0;
+	double _poll_time = 0;
+	Eigen::Vector3d _rest_force = Eigen::Vector3d::Zero();
+	unsigned long long _steps_asleep = 0;
+	unsigned long long _sleeps = 0;
+	unsigned long long _wakes = 0;
+};
+
+// total contact force on one link of a body. points and forces are scratch
+// buffers kept by the caller
+inline Eigen::Vector3d bodyContactForce(Simulation::Sai2Simulation* sim, const std::string& name,
+										const std::string& link, std::vector<Eigen::Vector3d>& points,
+										std::vector<Eigen::Vector3d>& forces)
+{
+	sim->getContactList(points, forces, name, link);
+	Eigen::Vector3d total = Eigen::Vector3d::Zero();
+	for (const Eigen::Vector3d& force : forces)
+		total += force;
+	return total;
+}
+
+#endif
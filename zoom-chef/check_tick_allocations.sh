@@ -0,0 +1,65 @@
+#!/bin/bash
+# Allocation check of the controller tick (alloc_counter.h), run by ctest when
+# zoom-chef is built with ZOOM_CHEF_ALLOC_COUNT or ZOOM_CHEF_ALLOC_ASSERT.
+#
+#   check_tick_allocations.sh <simviz_headless> <controller> [seconds] [max allocations]
+#
+# Starts the headless simulation and the controller, lets the recipe run for
+# the given seconds (default 10) and stops both. Fails if the controller
+# aborted (ZOOM_CHEF_ALLOC_ASSERT) or counted more tick allocations after
+# warm-up than allowed (default 0). Exits 77 (skipped) without a redis server,
+# which both executables connect to.
+# Run from bin/zoom-chef, next to resources/.
+
+simviz=$1
+controller=$2
+seconds=${3:-10}
+max_allocations=${4:-0}
+
+if ! redis-cli ping > /dev/null 2>&1; then
+	echo "No redis server, skipping the allocation check"
+	exit 77
+fi
+
+log=$(mktemp)
+"$simviz" > /dev/null 2>&1 &
+simviz_pid=$!
+trap 'kill -TERM $simviz_pid 2> /dev/null; wait $simviz_pid 2> /dev/null; rm -f "$log"' EXIT
+
+# the controller exits at once while simviz is still loading, start it again
+# until it stays up
+for attempt in $(seq 60); do
+	"$controller" > "$log" 2>&1 &
+	controller_pid=$!
+	sleep 1
+	if kill -0 $controller_pid 2> /dev/null; then
+		break
+	fi
+	wait $controller_pid
+	if ! grep -q "is simviz running" "$log"; then
+		cat "$log"
+		echo "Controller failed to start"
+		exit 1
+	fi
+done
+
+sleep "$seconds"
+kill -TERM $controller_pid 2> /dev/null
+wait $controller_pid
+status=$?
+cat "$log"
+if [ $status -ne 0 ]; then
+	echo "Controller exited with status $status"
+	exit 1
+fi
+
+allocations=$(sed -n 's/^Tick allocations *: \([0-9]*\) .*/\1/p' "$log")
+if [ -z "$allocations" ]; then
+	echo "No tick allocation count in the controller output"
+	exit 1
+fi
+if [ "$allocations" -gt "$max_allocations" ]; then
+	echo "$allocations tick allocations after warm-up, at most $max_allocations allowed"
+	exit 1
+fi
+echo "$allocations tick allocations after warm-up, at most $max_allocations allowed"
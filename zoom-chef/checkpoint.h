@@ -0,0 +1,255 @@
+#ifndef _CHECKPOINT_H
+#define _CHECKPOINT_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+
+// Snapshot of a zoom-chef run, to start both processes again from the middle
+// of the recipe. simviz writes one file per phase of the controller
+// (ZOOM_CHEF_CHECKPOINT_DIR) and both processes load one at startup
+// (ZOOM_CHEF_RESTORE).
+//
+// file layout, native byte order (files are not portable between hosts of a
+// different endianness):
+//   CheckpointHeader (32 bytes)
+//   per body:        uint32 name length, uint32 dof, name, q (dof doubles), dq (dof doubles)
+//   controller:      controller_size doubles, see below
+//   uint64           FNV-1a hash of everything before it
+//
+// The contact state of the engine is not in the file, dynamics3d does not give
+// access to it. Contacts are found again on the first step after a restore.
+
+constexpr char CHECKPOINT_MAGIC[8] = {'Z', 'C', 'C', 'K', 'P', 'T', 0, 0};
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+
+struct CheckpointHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t num_bodies;
+	double sim_time;           // simulated time of the snapshot in seconds
+	uint32_t controller_size;  // doubles of the controller state, 0 if there is none
+	uint32_t reserved;
+};
+
+static_assert(sizeof(CheckpointHeader) == 32, "checkpoint header layout");
+
+// controller state machine, published by the controller under
+// CONTROLLER_STATE_KEY whenever its phase changes.
+//
+// layout:
+//   [ state, task, station, gripper_state, grill_index, plate_index,
+//     relax_counter, num_foods | food_actuate (num_foods, 0 or 1) |
+//     desired position (3) | desired orientation (9, column major) |
+//     velocity saturation (0 or 1), linear saturation velocity ]
+//
+// the desired pose is the goal of the pose task, which is only set when a
+// task starts.
+constexpr int CONTROLLER_CHECKPOINT_HEADER_SIZE = 8;
+
+struct ControllerCheckpoint
+{
+	int state = 0;
+	int task = 0;
+	int station = 0;
+	int gripper_state = 0;
+	int grill_index = 0;
+	int plate_index = 0;
+	int relax_counter = 0;
+	Eigen::VectorXd food_actuate;
+	Eigen::Vector3d desired_position = Eigen::Vector3d::Zero();
+	Eigen::Matrix3d desired_orientation = Eigen::Matrix3d::Identity();
+	bool velocity_saturation = false;
+	double linear_saturation_velocity = 0;
+};
+
+inline int controllerCheckpointSize(int num_foods)
+{
+	return CONTROLLER_CHECKPOINT_HEADER_SIZE + num_foods + 3 + 9 + 2;
+}
+
+// pack into buf, which is only resized when the number of foods changes
+inline void packControllerCheckpoint(const ControllerCheckpoint& controller, Eigen::VectorXd& buf)
+{
+	const int num_foods = controller.food_actuate.size();
+	if (buf.size() != controllerCheckpointSize(num_foods))
+		buf.resize(controllerCheckpointSize(num_foods));
+
+	int i = 0;
+	buf(i++) = controller.state;
+	buf(i++) = controller.task;
+	buf(i++) = controller.station;
+	buf(i++) = controller.gripper_state;
+	buf(i++) = controller.grill_index;
+	buf(i++) = controller.plate_index;
+	buf(i++) = controller.relax_counter;
+	buf(i++) = num_foods;
+	buf.segment(i, num_foods) = controller.food_actuate; i += num_foods;
+	buf.segment<3>(i) = controller.desired_position; i += 3;
+	buf.segment<9>(i) = Eigen::Map<const Eigen::Matrix<double, 9, 1> >(controller.desired_orientation.data()); i += 9;
+	buf(i++) = controller.velocity_saturation;
+	buf(i++) = controller.linear_saturation_velocity;
+}
+
+// returns false and leaves controller untouched if buf is not a complete record
+inline bool unpackControllerCheckpoint(const Eigen::VectorXd& buf, ControllerCheckpoint& controller)
+{
+	if (buf.size() < CONTROLLER_CHECKPOINT_HEADER_SIZE)
+		return false;
+	const int num_foods = (int) buf(7);
+	if (num_foods < 0 || buf.size() != controllerCheckpointSize(num_foods))
+		return false;
+
+	int i = 0;
+	controller.state = (int) buf(i++);
+	controller.task = (int) buf(i++);
+	controller.station = (int) buf(i++);
+	controller.gripper_state = (int) buf(i++);
+	controller.grill_index = (int) buf(i++);
+	controller.plate_index = (int) buf(i++);
+	controller.relax_counter = (int) buf(i++);
+	i++;
+	controller.food_actuate = buf.segment(i, num_foods); i += num_foods;
+	controller.desired_position = buf.segment<3>(i); i += 3;
+	Eigen::Map<Eigen::Matrix<double, 9, 1> >(controller.desired_orientation.data()) = buf.segment<9>(i); i += 9;
+	controller.velocity_saturation = buf(i++) != 0;
+	controller.linear_saturation_velocity = buf(i++);
+	return true;
+}
+
+// joint state of every robot of the world (the robot, the spatula, the foods),
+// plus the packed controller state
+struct Checkpoint
+{
+	double sim_time = 0;
+	std::vector<std::string> names;
+	std::vector<Eigen::VectorXd> q;
+	std::vector<Eigen::VectorXd> dq;
+	Eigen::VectorXd controller;
+
+	void add(const std::string& name, const Eigen::VectorXd& body_q, const Eigen::VectorXd& body_dq)
+	{
+		names.push_back(name);
+		q.push_back(body_q);
+		dq.push_back(body_dq);
+	}
+
+	// index of the body called name, -1 if there is none
+	int index(const std::string& name) const
+	{
+		for (size_t i = 0; i < names.size(); i++)
+			if (names[i] == name)
+				return i;
+		return -1;
+	}
+};
+
+inline uint64_t checkpointHash(const std::string& bytes)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (unsigned char byte : bytes)
+		hash = (hash ^ byte) * 1099511628211ULL;
+	return hash;
+}
+
+inline bool writeCheckpoint(const std::string& path, const Checkpoint& checkpoint)
+{
+	CheckpointHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version = CHECKPOINT_VERSION;
+	header.num_bodies = checkpoint.names.size();
+	header.sim_time = checkpoint.sim_time;
+	header.controller_size = checkpoint.controller.size();
+
+	std::string bytes((const char*) &header, sizeof(header));
+	for (size_t i = 0; i < checkpoint.names.size(); i++)
+	{
+		uint32_t sizes[2] = {(uint32_t) checkpoint.names[i].size(), (uint32_t) checkpoint.q[i].size()};
+		bytes.append((const char*) sizes, sizeof(sizes));
+		bytes.append(checkpoint.names[i]);
+		bytes.append((const char*) checkpoint.q[i].data(), sizes[1] * sizeof(double));
+		bytes.append((const char*) checkpoint.dq[i].data(), sizes[1] * sizeof(double));
+	}
+	bytes.append((const char*) checkpoint.controller.data(), checkpoint.controller.size() * sizeof(double));
+	uint64_t hash = checkpointHash(bytes);
+	bytes.append((const char*) &hash, sizeof(hash));
+
+	std::ofstream file(path, std::ios::binary);
+	file.write(bytes.data(), bytes.size());
+	return (bool) file;
+}
+
+// on failure reason says why and checkpoint is left untouched
+inline bool readCheckpoint(const std::string& path, Checkpoint& checkpoint, std::string& reason)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+	{
+		reason = "cannot be opened";
+		return false;
+	}
+	std::stringstream contents;
+	contents << file.rdbuf();
+	const std::string bytes = contents.str();
+
+	CheckpointHeader header;
+	if (bytes.size() < sizeof(header) + sizeof(uint64_t))
+	{
+		reason = "is truncated";
+		return false;
+	}
+	memcpy(&header, bytes.data(), sizeof(header));
+	if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 || header.version != CHECKPOINT_VERSION)
+	{
+		reason = "is not a version " + std::to_string(CHECKPOINT_VERSION) + " checkpoint";
+		return false;
+	}
+	uint64_t hash;
+	memcpy(&hash, bytes.data() + bytes.size() - sizeof(hash), sizeof(hash));
+	if (hash != checkpointHash(bytes.substr(0, bytes.size() - sizeof(hash))))
+	{
+		reason = "is corrupt";
+		return false;
+	}
+
+	Checkpoint read;
+	read.sim_time = header.sim_time;
+	size_t offset = sizeof(header);
+	const size_t end = bytes.size() - sizeof(hash);
+	for (uint32_t b = 0; b < header.num_bodies; b++)
+	{
+		uint32_t sizes[2];
+		if (offset + sizeof(sizes) > end)
+			break;
+		memcpy(sizes, bytes.data() + offset, sizeof(sizes));
+		offset += sizeof(sizes);
+		if (offset + sizes[0] + 2 * sizes[1] * sizeof(double) > end)
+			break;
+		std::string name = bytes.substr(offset, sizes[0]);
+		offset += sizes[0];
+		Eigen::VectorXd q(sizes[1]), dq(sizes[1]);
+		memcpy(q.data(), bytes.data() + offset, sizes[1] * sizeof(double));
+		offset += sizes[1] * sizeof(double);
+		memcpy(dq.data(), bytes.data() + offset, sizes[1] * sizeof(double));
+		offset += sizes[1] * sizeof(double);
+		read.add(name, q, dq);
+	}
+	if (read.names.size() != header.num_bodies || offset + header.controller_size * sizeof(double) != end)
+	{
+		reason = "does not match its header";
+		return false;
+	}
+	read.controller.resize(header.controller_size);
+	memcpy(read.controller.data(), bytes.data() + offset, header.controller_size * sizeof(double));
+	checkpoint = read;
+	return true;
+}
+
+#endif
@@ -0,0 +1,375 @@
+// Offline step of the zoom-chef build (ZOOM_CHEF_COLLISION_HULLS): replaces a
+// collision mesh by convex hulls with a bounded number of vertices, so that
+// narrow phase collision in sim->integrate works on a few dozen vertices per
+// body instead of the full visual resolution.
+//
+//   collision_hull_zoom_chef [--max-vertices N] [--grid N] input.obj output.obj
+//
+// --max-vertices  vertex budget of every hull (default 64). meshes that are
+//                 already within the budget are copied unchanged
+// --grid N        split the mesh into N x N columns in x/y before hulling, one
+//                 hull per column. keeps concave shapes like the plate hollow
+//
+// The hull vertices are extreme points of the mesh along evenly spread
+// directions (the six axis directions first, so the bounding box is kept),
+// then the hull of those points is built incrementally.
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+struct Mesh
+{
+	vector<Vector3d> vertices;
+	vector<vector<int> > faces;  // 0 based vertex indices
+};
+
+bool readObj(const string& path, Mesh& mesh)
+{
+	ifstream file(path);
+	if (!file)
+		return false;
+	string line;
+	while (getline(file, line))
+	{
+		stringstream tokens(line);
+		string type;
+		tokens >> type;
+		if (type == "v")
+		{
+			Vector3d v;
+			tokens >> v(0) >> v(1) >> v(2);
+			mesh.vertices.push_back(v);
+		}
+		else if (type == "f")
+		{
+			vector<int> face;
+			string corner;
+			while (tokens >> corner)
+			{
+				int index = atoi(corner.c_str());  // stops at the first '/'
+				face.push_back(index < 0 ? (int) mesh.vertices.size() + index : index - 1);
+			}
+			if (face.size() >= 3)
+				mesh.faces.push_back(face);
+		}
+	}
+	return true;
+}
+
+// directions spread evenly over the sphere, the axis directions first
+vector<Vector3d> sphereDirections(int count)
+{
+	vector<Vector3d> directions = {Vector3d::UnitX(), -Vector3d::UnitX(), Vector3d::UnitY(),
+								   -Vector3d::UnitY(), Vector3d::UnitZ(), -Vector3d::UnitZ()};
+	const double golden_angle = M_PI * (3.0 - sqrt(5.0));
+	for (int i = 0; i < count; i++)
+	{
+		double z = 1.0 - 2.0 * (i + 0.5) / count;
+		double r = sqrt(1.0 - z * z);
+		directions.push_back(Vector3d(r * cos(golden_angle * i), r * sin(golden_angle * i), z));
+	}
+	return directions;
+}
+
+// index of the point furthest along direction
+int extremePoint(const vector<Vector3d>& points, const Vector3d& direction)
+{
+	int extreme = 0;
+	double extreme_dot = -INFINITY;
+	for (size_t i = 0; i < points.size(); i++)
+	{
+		double dot = direction.dot(points[i]);
+		if (dot > extreme_dot)
+		{
+			extreme_dot = dot;
+			extreme = i;
+		}
+	}
+	return extreme;
+}
+
+// at most max_points extreme points of points, as many as fit the budget. the
+// extremes along the six axis directions always come first, so the bounds of
+// the hull are kept. the rest of the budget goes to the extremes of more and
+// more sphere directions, and when a round has more than fit, to those
+// furthest from the points already chosen
+vector<Vector3d> extremePoints(const vector<Vector3d>& points, int max_points)
+{
+	vector<int> chosen;
+	set<int> taken;
+	for (int axis = 0; axis < 6; axis++)
+	{
+		Vector3d direction = Vector3d::Zero();
+		direction(axis / 2) = axis % 2 ? -1.0 : 1.0;
+		int extreme = extremePoint(points, direction);
+		if (taken.insert(extreme).second)
+			chosen.push_back(extreme);
+	}
+	if ((int) chosen.size() > max_points)
+		chosen.resize(max_points);
+
+	for (int count = max_points; count <= 64 * max_points && (int) chosen.size() < max_points; count *= 2)
+	{
+		vector<int> candidates;
+		for (const Vector3d& direction : sphereDirections(count))
+		{
+			int extreme = extremePoint(points, direction);
+			if (taken.insert(extreme).second)
+				candidates.push_back(extreme);
+		}
+		if (chosen.size() + candidates.size() <= (size_t) max_points)
+		{
+			chosen.insert(chosen.end(), candidates.begin(), candidates.end());
+			continue;
+		}
+
+		// squared distance of every candidate to the nearest chosen point
+		vector<double> distance(candidates.size(), INFINITY);
+		auto update = [&](int point)
+		{
+			for (size_t j = 0; j < candidates.size(); j++)
+				distance[j] = min(distance[j], (points[candidates[j]] - points[point]).squaredNorm());
+		};
+		for (int point : chosen)
+			update(point);
+		while ((int) chosen.size() < max_points)
+		{
+			size_t furthest = 0;
+			for (size_t j = 1; j < candidates.size(); j++)
+				if (distance[j] > distance[furthest])
+					furthest = j;
+			chosen.push_back(candidates[furthest]);
+			update(candidates[furthest]);
+			distance[furthest] = -INFINITY;
+		}
+	}
+
+	vector<Vector3d> best;
+	for (int i : chosen)
+		best.push_back(points[i]);
+	return best;
+}
+
+struct HullFace
+{
+	int a, b, c;
+	Vector3d normal;
+	double offset;
+	bool alive;
+};
+
+HullFace makeFace(const vector<Vector3d>& p, int a, int b, int c)
+{
+	HullFace face = {a, b, c, Vector3d::Zero(), 0, true};
+	face.normal = (p[b] - p[a]).cross(p[c] - p[a]);
+	double norm = face.normal.norm();
+	if (norm > 0)
+		face.normal /= norm;
+	face.offset = face.normal.dot(p[a]);
+	return face;
+}
+
+// incremental convex hull. returns false if the points are (nearly) coplanar
+bool convexHull(const vector<Vector3d>& p, vector<HullFace>& faces)
+{
+	if (p.size() < 4)
+		return false;
+	Vector3d lo = p[0], hi = p[0];
+	for (const Vector3d& v : p)
+	{
+		lo = lo.cwiseMin(v);
+		hi = hi.cwiseMax(v);
+	}
+	const double eps = 1e-9 * max(1.0, (hi - lo).norm());
+
+	// initial tetrahedron from far apart points
+	int i0 = 0, i1 = 0, i2 = 0, i3 = 0;
+	for (size_t i = 0; i < p.size(); i++)
+		if (p[i](0) < p[i0](0))
+			i0 = i;
+	for (size_t i = 0; i < p.size(); i++)
+		if ((p[i] - p[i0]).norm() > (p[i1] - p[i0]).norm())
+			i1 = i;
+	Vector3d axis = (p[i1] - p[i0]).normalized();
+	double best = 0;
+	for (size_t i = 0; i < p.size(); i++)
+	{
+		double distance = (p[i] - p[i0]).cross(axis).norm();
+		if (distance > best)
+		{
+			best = distance;
+			i2 = i;
+		}
+	}
+	Vector3d plane_normal = (p[i1] - p[i0]).cross(p[i2] - p[i0]).normalized();
+	best = 0;
+	for (size_t i = 0; i < p.size(); i++)
+	{
+		double distance = fabs(plane_normal.dot(p[i] - p[i0]));
+		if (distance > best)
+		{
+			best = distance;
+			i3 = i;
+		}
+	}
+	if (best < eps || (p[i1] - p[i0]).norm() < eps)
+		return false;
+
+	faces.clear();
+	Vector3d center = (p[i0] + p[i1] + p[i2] + p[i3]) / 4.0;
+	int tetra[4][3] = {{i0, i1, i2}, {i0, i3, i1}, {i0, i2, i3}, {i1, i3, i2}};
+	for (auto& t : tetra)
+	{
+		HullFace face = makeFace(p, t[0], t[1], t[2]);
+		if (face.normal.dot(center) - face.offset > 0)
+			face = makeFace(p, t[0], t[2], t[1]);
+		faces.push_back(face);
+	}
+
+	for (size_t i = 0; i < p.size(); i++)
+	{
+		if ((int) i == i0 || (int) i == i1 || (int) i == i2 || (int) i == i3)
+			continue;
+		// directed edges of the faces that see the point
+		set<pair<int, int> > edges;
+		for (HullFace& face : faces)
+		{
+			if (!face.alive || face.normal.dot(p[i]) - face.offset <= eps)
+				continue;
+			face.alive = false;
+			edges.insert(make_pair(face.a, face.b));
+			edges.insert(make_pair(face.b, face.c));
+			edges.insert(make_pair(face.c, face.a));
+		}
+		// the horizon is where a visible face meets one that is not
+		for (const pair<int, int>& edge : edges)
+			if (edges.count(make_pair(edge.second, edge.first)) == 0)
+				faces.push_back(makeFace(p, edge.first, edge.second, i));
+	}
+	faces.erase(remove_if(faces.begin(), faces.end(), [](const HullFace& f) { return !f.alive; }), faces.end());
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	int max_vertices = 64;
+	int grid = 1;
+	vector<string> files;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--max-vertices" && i + 1 < argc)
+			max_vertices = max(4, atoi(argv[++i]));
+		else if (arg == "--grid" && i + 1 < argc)
+			grid = max(1, atoi(argv[++i]));
+		else
+			files.push_back(arg);
+	}
+	if (files.size() != 2)
+	{
+		cout << "usage: " << argv[0] << " [--max-vertices N] [--grid N] input.obj output.obj" << endl;
+		return 1;
+	}
+
+	Mesh mesh;
+	if (!readObj(files[0], mesh) || mesh.vertices.empty())
+	{
+		cout << "Could not read mesh " << files[0] << endl;
+		return 1;
+	}
+
+	// small enough already, hand made collision meshes stay as they are
+	if ((int) mesh.vertices.size() <= max_vertices)
+	{
+		ifstream in(files[0], ios::binary);
+		ofstream out(files[1], ios::binary);
+		out << in.rdbuf();
+		cout << files[0] << ": " << mesh.vertices.size() << " vertices, copied" << endl;
+		return out ? 0 : 1;
+	}
+
+	// group the faces into grid x grid columns by their centroid
+	Vector3d lo = mesh.vertices[0], hi = mesh.vertices[0];
+	for (const Vector3d& v : mesh.vertices)
+	{
+		lo = lo.cwiseMin(v);
+		hi = hi.cwiseMax(v);
+	}
+	map<int, set<int> > parts;
+	if (mesh.faces.empty())
+	{
+		for (size_t i = 0; i < mesh.vertices.size(); i++)
+			parts[0].insert(i);
+	}
+	for (const vector<int>& face : mesh.faces)
+	{
+		Vector3d centroid = Vector3d::Zero();
+		for (int v : face)
+			centroid += mesh.vertices[v];
+		centroid /= face.size();
+		int cell_x = min(grid - 1, (int) (grid * (centroid(0) - lo(0)) / max(hi(0) - lo(0), 1e-12)));
+		int cell_y = min(grid - 1, (int) (grid * (centroid(1) - lo(1)) / max(hi(1) - lo(1), 1e-12)));
+		for (int v : face)
+			parts[cell_y * grid + cell_x].insert(v);
+	}
+
+	ofstream out(files[1]);
+	if (!out)
+	{
+		cout << "Could not write mesh " << files[1] << endl;
+		return 1;
+	}
+	out << "# convex hulls of " << files[0] << ", at most " << max_vertices << " vertices each, grid " << grid << "\n";
+	int vertex_base = 1;
+	int total_vertices = 0, total_faces = 0, num_hulls = 0;
+	for (const auto& part : parts)
+	{
+		vector<Vector3d> points;
+		for (int v : part.second)
+			points.push_back(mesh.vertices[v]);
+		vector<Vector3d> hull_points = extremePoints(points, max_vertices);
+		vector<HullFace> faces;
+		if (!convexHull(hull_points, faces))
+			continue;  // flat part, the neighbouring columns cover it
+
+		// keep only the points on the hull
+		map<int, int> index;
+		for (const HullFace& face : faces)
+			for (int v : {face.a, face.b, face.c})
+				if (index.count(v) == 0)
+				{
+					int next = index.size();
+					index[v] = next;
+				}
+		vector<int> order(index.size());
+		for (const auto& entry : index)
+			order[entry.second] = entry.first;
+
+		out << "o hull_" << num_hulls++ << "\n";
+		for (int v : order)
+			out << "v " << hull_points[v](0) << " " << hull_points[v](1) << " " << hull_points[v](2) << "\n";
+		for (const HullFace& face : faces)
+			out << "f " << vertex_base + index[face.a] << " " << vertex_base + index[face.b] << " "
+				<< vertex_base + index[face.c] << "\n";
+		vertex_base += order.size();
+		total_vertices += order.size();
+		total_faces += faces.size();
+	}
+	cout << files[0] << ": " << mesh.vertices.size() << " vertices, " << mesh.faces.size() << " faces -> " << num_hulls
+		 << " hulls, " << total_vertices << " vertices, " << total_faces << " faces" << endl;
+	return num_hulls > 0 ? 0 : 1;
+}
@@ -9,6 +9,22 @@
 
 #include <iostream>
 #include <string>
+#include <thread>
+#include <cstdlib>
+
+#include "keys.h"
+#include "transport.h"
+#include "world_state.h"
+#include "phase_timer.h"
+#include "alloc_counter.h"
+#include "model_updater.h"
+#include "trace.h"
+#include "loop_stats.h"
+#include "rt_profile.h"
+#include "scene.h"
+#include "startup_loader.h"
+#include "checkpoint.h"
+#include "rtf_tuner.h"
 
 #include <signal.h>
 bool runloop = true;
@@ -23,19 +39,19 @@ using namespace Eigen;
 // panda + mobile base + gripper
 //spatula
 const string robot_file = "./resources/mmp_panda.urdf";
+const string robot_name = "mmp_panda";
 // const string spatula_file = "./resources/spatula.urdf";
-// //burger
-const string burger_file = "./resources/burger.urdf";
-const string burger_name = "burger"; 
-// bun 1
-const string bottom_bun_file = "./resources/bottom_bun.urdf";
-const string bottom_bun_name = "bot_bun"; 
-// // bun 2
-const string top_bun_file = "./resources/top_bun.urdf";
-const string top_bun_name = "top_bun"; 
-// cheese
-// tomato
-// lettuce
+const string spatula_name = "spatula";
+// the foods are read from the world file, see scene.h
+const string world_file = "./resources/world_panda_gripper.urdf";
+
+// the burger: foods in the order they are flipped onto the grill, and in the
+// order they are stacked on the plate (bottom first) with the gain of their
+// stacking task
+#define NUM_RECIPE_FOODS 3
+const string grill_order[NUM_RECIPE_FOODS] = {"burger", "bottom_bun", "top_bun"};
+const string plate_order[NUM_RECIPE_FOODS] = {"bottom_bun", "burger", "top_bun"};
+const double plate_kp[NUM_RECIPE_FOODS] = {80.0, 80.0, 75.0};
 
 // states
 #define JOINT_CONTROLLER      0
@@ -52,6 +68,9 @@ const string top_bun_name = "top_bun";
 #define RESET			      8
 #define ALIGN                 9
 #define PLATE                10
+#define NUM_TASKS            11
+const char* const task_names[NUM_TASKS] = {"IDLE", "SPATULA_PRE_POS", "SPATULA_GRASP_POS", "SLIDE", "LIFT_SPATULA",
+	"DROP_FOOD", "RELAX_WRIST", "FLEX_WRIST", "RESET", "ALIGN", "PLATE"};
 // gripper states
 #define OPEN                  0
 #define CLOSED                1
@@ -62,29 +81,18 @@ const string top_bun_name = "top_bun";
 // print
 #define VERBOSE				  0
 
+// phase timing report, written at shutdown. see phase_timer.h
+const string phase_report_csv = "zoom_chef_phases.csv";
+const string phase_report_json = "zoom_chef_phases.json";
+
+// chrome trace of the loop (ZOOM_CHEF_TRACE), written at shutdown and on SIGUSR1
+const string trace_file = "zoom_chef_trace_controller.json";
+
 int state = JOINT_CONTROLLER;
 int task = SPATULA_PRE_POS;
 int station = STATION_2;
 int gripper_state = OPEN;
-// redis keys:
-// - read:
-std::string JOINT_ANGLES_KEY;
-std::string JOINT_VELOCITIES_KEY;
-std::string JOINT_TORQUES_SENSED_KEY;
-std::string SPATULA_POSITION_KEY;
-std::string SPATULA_ORIENTATION_KEY;
-std::string SPATULA_JOINT_ANGLES_KEY;
-std::string BURGER_POSITION_KEY;
-std::string BURGER_ORIENTATION_KEY;
-std::string BURGER_JOINT_ANGLES_KEY;
-std::string BOTTOM_BUN_POSITION_KEY;
-std::string TOP_BUN_POSITION_KEY;
-std::string BOTTOM_BUN_TORQUES_COMMANDED_KEY;
-std::string BURGER_TORQUES_COMMANDED_KEY;
-std::string TOP_BUN_TORQUES_COMMANDED_KEY;
-// - write
-std::string JOINT_TORQUES_COMMANDED_KEY;
-
+// redis keys: see keys.h
 // - model
 std::string MASSMATRIX_KEY;
 std::string CORIOLIS_KEY;
@@ -94,104 +102,114 @@ unsigned long long controller_counter = 0;
 int relax_counter = 0;
 const bool inertia_regularization = true;
 
+// control and model rates. the robot dynamics are refreshed at
+// model_update_frequency (ZOOM_CHEF_MODEL_RATE in the environment overrides it,
+// 0 refreshes them every tick). see model_updater.h
+const double control_frequency = 1000;
+const double model_update_frequency = 250;
 
-int main() {
 
-	JOINT_ANGLES_KEY = "sai2::cs225a::project::sensors::q";
-	JOINT_VELOCITIES_KEY = "sai2::cs225a::project::sensors::dq";
-	JOINT_TORQUES_COMMANDED_KEY = "sai2::cs225a::project::actuators::fgc";
-	// KEY FOR SPATULA POSITION
-	SPATULA_POSITION_KEY = "sai2::cs225a::spatula::sensors::r_spatula";
-	SPATULA_ORIENTATION_KEY = "sai2::cs225a::spatula::sensors::ori_spatula";
-	SPATULA_JOINT_ANGLES_KEY = "sai2::cs225a::spatula::sensors::spatula_q";
-	// KEY POSITION FOR BURGER
-	BURGER_POSITION_KEY = "sai2::cs225a::burger::sensors::r_burger";
-	TOP_BUN_POSITION_KEY = "sai2::cs225a::top_bun::sensors::r_top_bun";
-	// KEY POSITION FOR BUNS
-	BOTTOM_BUN_TORQUES_COMMANDED_KEY = "sai2::cs225a::project::actuators::bottom_bun";
-
-	BOTTOM_BUN_POSITION_KEY = "sai2::cs225a::bottom_bun::sensors::r_bottom_bun";
-	BURGER_TORQUES_COMMANDED_KEY = "sai2::cs225a::project::actuators::burger";
-	TOP_BUN_TORQUES_COMMANDED_KEY = "sai2::cs225a::project::actuators::top_bun";
+int main() {
 
 	// start redis client
 	auto redis_client = RedisClient();
 	redis_client.connect();
 
+	// hot keys to the simulation, see transport.h
+	HotKeyTransport transport(redis_client);
+	if (!transport.open(false))
+		return 1;
+
 	// set up signal handler
 	signal(SIGABRT, &sighandler);
 	signal(SIGTERM, &sighandler);
 	signal(SIGINT, &sighandler);
+	TRACE_INSTALL_SIGNAL_HANDLER();
+
+	// read the first world state published by the simulation
+	WorldState world;
+	VectorXd world_state_buf;
+	transport.get(WORLD_STATE_KEY, world_state_buf);
+	if (!unpackWorldState(world_state_buf, world))
+	{
+		cout << "Invalid world state on " << WORLD_STATE_KEY << ", is simviz running?" << endl;
+		return 1;
+	}
+
+	// foods of the scene, in the same order as in the world state
+	FoodTable foods;
+	if (!loadFoodTable(world_file, {robot_name, spatula_name}, foods))
+		return 1;
+	if (world.r_foods.cols() != foods.num_foods)
+	{
+		cout << "The simulation has " << world.r_foods.cols() << " foods, " << world_file << " has "
+			 << foods.num_foods << endl;
+		return 1;
+	}
+
+	// load the robot and the models of the recipe foods in parallel
+	// (startup_loader.h), one per food column, the others stay null
+	StartupLoader loader;
+	Sai2Model::Sai2Model* robot = nullptr;
+	loader.add("model " + robot_name, [&] { robot = new Sai2Model::Sai2Model(robot_file, false); });
+	vector<Sai2Model::Sai2Model*> food_models(foods.num_foods, nullptr);
+	for (int f = 0; f < NUM_RECIPE_FOODS; f++)
+	{
+		int column = foods.index(plate_order[f]);
+		if (column >= 0)
+			loader.add("model " + foods.names[column],
+					   [&, column] { food_models[column] = new Sai2Model::Sai2Model(foods.files[column], false); });
+	}
+	loader.wait();
+	loader.print();
+
+	robot->_q = world.q;
+	robot->_dq = world.dq;
+	robot->updateModel();
+
+#ifdef USING_LOCKSTEP
+	// the simulation is blocked until this state has been answered
+	unsigned long long last_world_seq = world.seq - 1;
+#else
+	unsigned long long last_world_seq = world.seq;
+#endif
+	unsigned long long stale_world_states = 0;
+	unsigned long long missed_world_states = 0;
+#ifndef USING_LOCKSTEP
+	bool warned_rtf = false;
+#endif
 
-	// load robots
-	auto robot = new Sai2Model::Sai2Model(robot_file, false);
-	robot->_q = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEY);
 	VectorXd initial_q = robot->_q;
 	// cout << initial_q << endl << endl;
-	robot->updateModel();
 	//----------------------------------------***** KITCHEN FOOD ROBOTS *****-----------------------------------------------
-	auto bottom_bun = new Sai2Model::Sai2Model(bottom_bun_file, false);
-	Vector3d r_bottom_bun = redis_client.getEigenMatrixJSON(BOTTOM_BUN_POSITION_KEY);
-	VectorXd bottom_bun_command_torques = VectorXd::Zero(6);
-
-	auto burger = new Sai2Model::Sai2Model(burger_file, false);
-	Vector3d r_burger = redis_client.getEigenMatrixJSON(BURGER_POSITION_KEY);
-	VectorXd burger_command_torques = VectorXd::Zero(6);
-
-	auto top_bun = new Sai2Model::Sai2Model(top_bun_file, false);
-	Vector3d r_top_bun = redis_client.getEigenMatrixJSON(TOP_BUN_POSITION_KEY);
-	VectorXd top_bun_command_torques = VectorXd::Zero(6);
-
-
-	// for (int i=0; i<3; i++)
-	// {
-	// 	bottom_bun->_q(i)=r_bottom_bun(i);
-
-	// }
-	bottom_bun->updateModel();
-	bool bottom_bun_actuate = false;
-	MatrixXd N_bottom_bun = MatrixXd::Identity(6, 6);
-
-	burger->updateModel();
-	bool burger_actuate = false;
-	MatrixXd N_burger = MatrixXd::Identity(6, 6);
-
-	top_bun->updateModel();
-	bool top_bun_actuate = false;
-	MatrixXd N_top_bun = MatrixXd::Identity(6, 6);
-
-	// auto bottom_bun = new Sai2Model::Sai2Model(bottom_bun_file, false);
-	// Vector3d r_bottom_bun = redis_client.getEigenMatrixJSON(BOTTOM_BUN_POSITION_KEY);
-	// for (int i=0; i<3; i++)
-	// {
-	// 	bottom_bun->_q(i)=r_bottom_bun(i);
-	// }
-
-	// auto bottom_bun = new Sai2Model::Sai2Model(bottom_bun_file, false);
-	// Vector3d r_bottom_bun = redis_client.getEigenMatrixJSON(BOTTOM_BUN_POSITION_KEY);
-	// for (int i=0; i<3; i++)
-	// {
-	// 	bottom_bun->_q(i)=r_bottom_bun(i);
-	// }
-	// bool food_actuate[] = {bottom_bun_actuate};
-	// use plate food index
-
-	auto bottom_bun_task = new Sai2Primitives::JointTask(bottom_bun);
-	bottom_bun_task->_kp = 80.0;
-	bottom_bun_task->_kv = 50.0;
-
-	auto burger_task = new Sai2Primitives::JointTask(burger);
-	burger_task->_kp = 80.0;
-	burger_task->_kv = 50.0;
-
-	auto top_bun_task = new Sai2Primitives::JointTask(top_bun);
-	top_bun_task->_kp = 75.0;
-	top_bun_task->_kv = 50.0;
-
-	bool food_actuate[] = {bottom_bun_actuate, burger_actuate, top_bun_actuate};
-	MatrixXd N_food[] = {N_bottom_bun, N_burger, N_top_bun};
-	Sai2Primitives::JointTask * food_task[] = {bottom_bun_task, burger_task, top_bun_task};
-	Sai2Model::Sai2Model * food_robot[] = {bottom_bun, burger, top_bun};
+	// one entry per recipe food, in plate order. grill_column and plate_column
+	// are the columns of the foods in the world state and the food torques
+	int grill_column[NUM_RECIPE_FOODS];
+	int plate_column[NUM_RECIPE_FOODS];
+	bool food_actuate[NUM_RECIPE_FOODS];
+	Sai2Model::Sai2Model* food_robot[NUM_RECIPE_FOODS];
+	Sai2Primitives::JointTask* food_task[NUM_RECIPE_FOODS];
+	for (int f = 0; f < NUM_RECIPE_FOODS; f++)
+	{
+		grill_column[f] = foods.index(grill_order[f]);
+		plate_column[f] = foods.index(plate_order[f]);
+		if (grill_column[f] < 0 || plate_column[f] < 0)
+		{
+			cout << "The recipe needs " << (grill_column[f] < 0 ? grill_order[f] : plate_order[f])
+				 << ", which is not in " << world_file << endl;
+			return 1;
+		}
+		food_actuate[f] = false;
+		food_robot[f] = food_models[plate_column[f]];
+		food_robot[f]->updateModel();
+		food_task[f] = new Sai2Primitives::JointTask(food_robot[f]);
+		food_task[f]->_kp = plate_kp[f];
+		food_task[f]->_kv = 50.0;
+	}
+	MatrixXd N_food = MatrixXd::Identity(6, 6);
+	// torques of all foods, sent in one key. foods that are not stacked get none
+	VectorXd food_command_torques = VectorXd::Zero(6 * foods.num_foods);
+	VectorXd food_task_torques = VectorXd::Zero(6);
 	// use plate_index
 
 	//----------------------------------------***** KITCHEN FOOD ROBOTS *****-----------------------------------------------
@@ -223,9 +241,9 @@ int main() {
 	Vector3d r_spatula = Vector3d::Zero();
 	Matrix3d ori_spatula = Matrix3d::Zero();
 	VectorXd spatula_q(6);
-	r_spatula = redis_client.getEigenMatrixJSON(SPATULA_POSITION_KEY);	
+	r_spatula = world.r_spatula;
 	Vector3d r_spatula_init = r_spatula;
-	ori_spatula = redis_client.getEigenMatrixJSON(SPATULA_ORIENTATION_KEY);	
+	ori_spatula = world.ori_spatula;
 	Vector3d del_r; // r_spatula - r_end_effector
 	Matrix3d ori_spatula_level = ori_spatula;
 	// spatula_q = redis_client.getEigenMatrixJSON(SPATULA_JOINT_ANGLES_KEY);	
@@ -278,12 +296,64 @@ int main() {
 	VectorXd q_init_desired = initial_q;
 	joint_task->_desired_position = q_init_desired;
 
+	// phase last published under CONTROLLER_STATE_KEY, it is sent again when the
+	// phase changes so that simviz can write a checkpoint (checkpoint.h)
+	ControllerCheckpoint phase;
+	phase.state = -1;
+	phase.food_actuate = VectorXd::Zero(NUM_RECIPE_FOODS);
+	VectorXd controller_state_buf;
+
+	// continue a run from a checkpoint (ZOOM_CHEF_RESTORE, checkpoint.h): the
+	// phase of the state machine and the goal of the pose task. simviz restores
+	// the robot and the objects from the same file
+	if (getenv("ZOOM_CHEF_RESTORE") != nullptr)
+	{
+		const string path = getenv("ZOOM_CHEF_RESTORE");
+		Checkpoint checkpoint;
+		ControllerCheckpoint restored;
+		string reason;
+		if (!readCheckpoint(path, checkpoint, reason))
+		{
+			cout << "Checkpoint " << path << " " << reason << endl;
+			return 1;
+		}
+		if (!unpackControllerCheckpoint(checkpoint.controller, restored) ||
+			restored.food_actuate.size() != NUM_RECIPE_FOODS || restored.task < 0 || restored.task >= NUM_TASKS)
+		{
+			cout << "Checkpoint " << path << " has no state of this controller" << endl;
+			return 1;
+		}
+		state = restored.state;
+		task = restored.task;
+		station = restored.station;
+		gripper_state = restored.gripper_state;
+		grill_index = restored.grill_index;
+		plate_index = restored.plate_index;
+		relax_counter = restored.relax_counter;
+		for (int f = 0; f < NUM_RECIPE_FOODS; f++)
+			food_actuate[f] = restored.food_actuate(f) != 0;
+		posori_task->reInitializeTask();
+		posori_task->_desired_position = restored.desired_position;
+		posori_task->_desired_orientation = restored.desired_orientation;
+		posori_task->_use_velocity_saturation_flag = restored.velocity_saturation;
+		posori_task->_linear_saturation_velocity = restored.linear_saturation_velocity;
+		// simviz already has a checkpoint of this phase, do not publish it again
+		phase = restored;
+		cout << "Restored checkpoint " << path << ": " << task_names[task] << ", grill_index " << grill_index
+			 << ", plate_index " << plate_index << endl << endl;
+	}
+
 	// create a timer
 	LoopTimer timer;
 	timer.initializeTimer();
-	timer.setLoopFrequency(1000); 
+	timer.setLoopFrequency(control_frequency); 
 	double start_time = timer.elapsedTime(); //secs
+#ifndef USING_LOCKSTEP
 	bool fTimerDidSleep = true;
+#endif
+
+	// entry/exit times of every task and food iteration
+	PhaseTimer phase_timer(task_names, NUM_TASKS);
 
 	Matrix3d good_ee_rot;
 	good_ee_rot << 0.703586,  -0.710608, -0.0017762,
@@ -332,29 +402,117 @@ int main() {
 	plate_food << -0.45, 0.5-0.221, 0.48;
 	// plate_food << -0.415193+0.02, 0.481433-0.21, 0.53;
 	
-	double y_offset_tip = 0.051;  // according to onshape - distance between spatula origin and front of spatula base
+	// loop variables, allocated once here so the tick itself does not allocate
+	int plate_shift[] = {1, 0, 2};
+	VectorXd q_curr_desired(dof);
+	VectorXd g_food(6);
+	g_food << 9.81, 0, 0, 0, 0, 0;
+	g_food *= 0.173;
+
+	// counts allocations inside the tick, after 1000 warm-up ticks
+	TickAllocCounter alloc_counter(1000);
+
+	// dynamics at the model rate, on a worker thread unless in lockstep
+	double model_frequency = model_update_frequency;
+	if (getenv("ZOOM_CHEF_MODEL_RATE") != nullptr)
+		model_frequency = atof(getenv("ZOOM_CHEF_MODEL_RATE"));
+#ifdef USING_LOCKSTEP
+	ModelUpdater model_updater(robot_file, robot, control_frequency, model_frequency, false);
+#else
+	ModelUpdater model_updater(robot_file, robot, control_frequency, model_frequency, true);
+#endif
+	// task models are updated with new dynamics and when the controller changes
+	int task_model_state = -1;
+
+	// period, compute time and overrun histograms, see loop_stats.h
+#ifdef USING_LOCKSTEP
+	LoopStats loop_stats("Controller", 0);
+#else
+	LoopStats loop_stats("Controller", control_frequency);
+#endif
+
+	// opt-in real-time scheduling of this thread (ZOOM_CHEF_CONTROLLER_RT, see
+	// rt_profile.h). after starting the model worker, which stays a normal thread
+	applyRtProfile(rtProfileFromEnv("ZOOM_CHEF_CONTROLLER_RT", 80), "controller");
+
+	TRACE_THREAD_NAME("control");
 	while (runloop) {
+#ifdef USING_LOCKSTEP
+		// lockstep: exactly one tick per physics step. wait until the
+		// simulation publishes a step we have not answered yet
+		{
+			TRACE_SCOPE("wait for world state");
+			transport.get(WORLD_STATE_KEY, world_state_buf);
+			while (runloop && (!unpackWorldState(world_state_buf, world) || world.seq == last_world_seq))
+			{
+				if (transport.writerStalled(WORLD_STATE_KEY))
+				{
+					cout << "Simulation stopped publishing the world state, stopping" << endl;
+					runloop = false;
+					break;
+				}
+				this_thread::yield();
+				transport.get(WORLD_STATE_KEY, world_state_buf);
+			}
+		}
+		if (!runloop)
+			break;
+		loop_stats.loopStart();
+#else
 		// wait for next scheduled loop
-		timer.waitForNextLoop();
+		fTimerDidSleep = timer.waitForNextLoop();
+		loop_stats.loopStart(fTimerDidSleep);
+
+		// read robot state. every value below comes from the same physics step
+		{
+			TRACE_SCOPE("read world state");
+			transport.get(WORLD_STATE_KEY, world_state_buf);
+		}
+#endif
+		TRACE_SCOPE("tick");
 		double time = timer.elapsedTime() - start_time;
 
-		// read robot state from redis
-		robot->_q = redis_client.getEigenMatrixJSON(JOINT_ANGLES_KEY);
-		robot->_dq = redis_client.getEigenMatrixJSON(JOINT_VELOCITIES_KEY);
-		r_spatula = redis_client.getEigenMatrixJSON(SPATULA_POSITION_KEY);		
-		ori_spatula = redis_client.getEigenMatrixJSON(SPATULA_ORIENTATION_KEY);
+		if (unpackWorldState(world_state_buf, world))
+		{
+			if (world.seq == last_world_seq)
+			{
+				stale_world_states++;
+				if (transport.writerStalled(WORLD_STATE_KEY))
+				{
+					cout << "Simulation stopped publishing the world state, stopping" << endl;
+					break;
+				}
+			}
+			else if (world.seq > last_world_seq + 1)
+				missed_world_states += world.seq - last_world_seq - 1;
+			last_world_seq = world.seq;
+#ifndef USING_LOCKSTEP
+			// the gains are only checked up to RTF_GAINS_CHECKED (rtf_tuner.h),
+			// in lockstep every tick is 1 ms of simulated time at any factor
+			if (world.rtf > RTF_GAINS_CHECKED * 1.05 && !warned_rtf)
+			{
+				cout << "Warning: simulation real time factor " << world.rtf << ", the controller gains are only checked up to "
+					 << RTF_GAINS_CHECKED << endl;
+				warned_rtf = true;
+			}
+#endif
+		}
 
-		r_bottom_bun = redis_client.getEigenMatrixJSON(BOTTOM_BUN_POSITION_KEY);
-		r_top_bun = redis_client.getEigenMatrixJSON(TOP_BUN_POSITION_KEY);
-		r_burger = redis_client.getEigenMatrixJSON(BURGER_POSITION_KEY);
+		// from here on the tick must not allocate, see alloc_counter.h
+		alloc_counter.begin();
 
-		Vector3d grill_foods[] = {r_burger, r_bottom_bun, r_top_bun};
-		Vector3d foods[] = {r_bottom_bun, r_burger, r_top_bun};
-		int plate_shift[] = {1, 0, 2};
+		robot->_q = world.q;
+		robot->_dq = world.dq;
+		r_spatula = world.r_spatula;
+		ori_spatula = world.ori_spatula;
 		// update model
-		robot->updateModel();
+		bool update_task_models;
+		{
+			TRACE_SCOPE("update model");
+			update_task_models = model_updater.update(robot) || state != task_model_state;
+		}
+		task_model_state = state;
 		
-		VectorXd q_curr_desired(12);
 		q_curr_desired = robot->_q;
 
 		Vector3d ee_pos;
@@ -365,8 +523,12 @@ int main() {
 		if(state == JOINT_CONTROLLER)
 		{
 			// update task model and set hierarchy
-			N_prec.setIdentity();
-			joint_task->updateTaskModel(N_prec);
+			if (update_task_models)
+			{
+				TRACE_SCOPE("update task model");
+				N_prec.setIdentity();
+				joint_task->updateTaskModel(N_prec);
+			}
 			joint_task->_use_velocity_saturation_flag = false;
 
 			// if(task == IDLE)
@@ -404,7 +566,10 @@ int main() {
 
 			joint_task->_desired_position = q_curr_desired;
 			// compute torques
-			joint_task->computeTorques(joint_task_torques);
+			{
+				TRACE_SCOPE("compute torques");
+				joint_task->computeTorques(joint_task_torques);
+			}
 
 			command_torques = joint_task_torques;
 
@@ -439,14 +604,14 @@ int main() {
 				else if (task == RESET)
 				{
 					// grill_index++;
-					if (grill_index < 3)
+					if (grill_index < NUM_RECIPE_FOODS)
 					{
 						cout << "Aligning..." << endl << endl;
 						task = ALIGN;
 						state = POSORI_CONTROLLER;
 						posori_task->reInitializeTask();
 						
-						Vector3d r_food = grill_foods[grill_index];
+						Vector3d r_food = world.r_foods.col(grill_column[grill_index]);
 						cout << "Current Food..." << grill_index << endl << endl;
 						posori_task->_desired_orientation = good_ee_rot;
 					}
@@ -462,8 +627,12 @@ int main() {
 		else if(state == POSORI_CONTROLLER)
 		{
 			// update task model and set hierarchy
-			N_prec.setIdentity();
-			posori_task->updateTaskModel(N_prec);
+			if (update_task_models)
+			{
+				TRACE_SCOPE("update task model");
+				N_prec.setIdentity();
+				posori_task->updateTaskModel(N_prec);
+			}
 	
 			// FIX BASE
 			joint_task->_use_velocity_saturation_flag = true;
@@ -480,7 +649,11 @@ int main() {
 				q_curr_desired(11) = -finger_closed_pos;
 			}
 			joint_task->_desired_position = q_curr_desired;
-			joint_task->updateTaskModel(posori_task->_N);
+			if (update_task_models)
+			{
+				TRACE_SCOPE("update task model");
+				joint_task->updateTaskModel(posori_task->_N);
+			}
 
 			if (task == SPATULA_PRE_POS)
 			{
@@ -504,7 +677,7 @@ int main() {
 			else if (task == ALIGN)
 			{
 				Vector3d r_align;
-				if (grill_index < 3)
+				if (grill_index < NUM_RECIPE_FOODS)
 				{
 					// Vector3d r_food = grill_foods[grill_index];					
 					// r_align(0) = r_food(0) - ((r_food(0) - r_spatula(0))/2) + 0.04*grill_index;
@@ -513,14 +686,14 @@ int main() {
 
 					// // new
 					Vector3d robot_offset = Vector3d(0.0, -0.05, 0.3514);
-					Vector3d r_food = grill_foods[grill_index];		
+					Vector3d r_food = world.r_foods.col(grill_column[grill_index]);
 					r_align = r_food - robot_offset;	
 					double sim_offset = 0.005;
 					r_align(1) -= y_slide; 
 					r_align(2) += 0.11683695 + (0.17 - 0.107) * cos(30 * M_PI / 180) + sim_offset;
 				}
 
-				else if (plate_index < 3)
+				else if (plate_index < NUM_RECIPE_FOODS)
 				{
 					// Vector3d r_food = foods[plate_index];
 					// r_align(0) = r_food(0) - ((r_food(0) - r_spatula(0))/2) - 0.3*plate_shift[plate_index];
@@ -528,7 +701,7 @@ int main() {
 					// r_align(2) = r_food(2) + (r_food(2)-r_spatula(2)) - 0.1 + (0.0254);
 
 					Vector3d robot_offset = Vector3d(0.0, -0.05, 0.3514);
-					Vector3d r_food = foods[plate_index];		
+					Vector3d r_food = world.r_foods.col(plate_column[plate_index]);
 					r_align = r_food - robot_offset;	
 					double sim_offset = 0.005;
 					r_align(1) -= y_slide; 
@@ -539,8 +712,11 @@ int main() {
 			}
 			
 			// compute torques
-			posori_task->computeTorques(posori_task_torques);
-			joint_task->computeTorques(joint_task_torques);
+			{
+				TRACE_SCOPE("compute torques");
+				posori_task->computeTorques(posori_task_torques);
+				joint_task->computeTorques(joint_task_torques);
+			}
 
 			command_torques = posori_task_torques + joint_task_torques;
 			
@@ -576,14 +752,14 @@ int main() {
 				} 
 				else if (task == LIFT_SPATULA) 
 				{
-					if (grill_index < 3)
+					if (grill_index < NUM_RECIPE_FOODS)
 					{
 						state = JOINT_CONTROLLER;
 						cout << "Changing station..." << endl << endl;
 						joint_task->reInitializeTask();
 						station = STATION_1;
 					}
-					else if (plate_index < 3)
+					else if (plate_index < NUM_RECIPE_FOODS)
 					{
 						state = POSORI_CONTROLLER;
 						cout << "Plating food #" << plate_index << " ..." << endl << endl;
@@ -631,16 +807,16 @@ int main() {
 				}
 				else if (task == FLEX_WRIST)
 				{
-					if(grill_index < 3) 
+					if(grill_index < NUM_RECIPE_FOODS) 
 					{
 						grill_index++;
-					} else if (plate_index <3) 
+					} else if (plate_index < NUM_RECIPE_FOODS) 
 					{
 						food_actuate[plate_index] = true;
 						plate_index++;
 					}
 
-					if(grill_index < 3)
+					if(grill_index < NUM_RECIPE_FOODS)
 					{
 						state = JOINT_CONTROLLER;
 						task = RESET;
@@ -648,7 +824,7 @@ int main() {
 						joint_task->reInitializeTask();
 						station = STATION_2;
 					}
-					else if (plate_index < 3)
+					else if (plate_index < NUM_RECIPE_FOODS)
 					{
 						state = POSORI_CONTROLLER;
 						cout << "Aligning for plate#" << plate_index << "..." << endl << endl;
@@ -659,21 +835,22 @@ int main() {
 						//}
 						
 					}
-					else if (plate_index == 3)
+					else if (plate_index == NUM_RECIPE_FOODS)
 					{
 						state = JOINT_CONTROLLER;
 						task = IDLE;
+						phase_timer.burgerDone(time, world.sim_time);
 						// food_actuate[plate_index-1] = true;
 					}
 				}
 				else if (task == ALIGN)
 				{
 					task = SLIDE;
-					if (grill_index < 3)
+					if (grill_index < NUM_RECIPE_FOODS)
 					{
 						cout << "Sliding for Grill Food " << grill_index << "..." << endl << endl;
 					} 
-					else if (plate_index < 3)
+					else if (plate_index < NUM_RECIPE_FOODS)
 					{
 						cout << "Sliding for Plate Food " << plate_index << "..." << endl << endl;
 					}						
@@ -691,17 +868,16 @@ int main() {
 		}// posori if-statement
 //-----------------------------------------------*******STACKING FOOD CONTROL********---------------------------------------------------------
 		// //if(food_actuate[plate_index])
-		for(int f = 0; f < 3; f++)
+		for(int f = 0; f < NUM_RECIPE_FOODS; f++)
 		{
-			//if(bottom_bun_actuate)
-
 			if(food_actuate[f] == true)
 			{
+				TRACE_SCOPE("food task");
 				Sai2Primitives::JointTask * curr_food_task;
 				curr_food_task = food_task[f];
 
-				N_bottom_bun.setIdentity();
-				curr_food_task->updateTaskModel(N_bottom_bun);
+				N_food.setIdentity();
+				curr_food_task->updateTaskModel(N_food);
 
 				Vector3d q_food_desired;
 
@@ -712,7 +888,7 @@ int main() {
 					q_food_desired(2) = -0.45;
 				}
 
-				else if(f==1 or f==2)
+				else
 				{
 					q_food_desired(0) = food_robot[f-1]->_q(0) + 0.027;
 					q_food_desired(1) = food_robot[f-1]->_q(1);
@@ -720,7 +896,7 @@ int main() {
 				}			
 
 				Vector3d r_food;
-				r_food = foods[f];
+				r_food = world.r_foods.col(plate_column[f]);
 				food_robot[f]->_q(0) = r_food(2);
 				food_robot[f]->_q(1) = r_food(1);
 				food_robot[f]->_q(2) = r_food(0);
@@ -730,52 +906,85 @@ int main() {
 					curr_food_task->_desired_position(i) = q_food_desired(i);
 				}
 
-				Eigen::VectorXd g_food(6);
-				g_food << 9.81, 0, 0, 0, 0, 0;
-				g_food *= 0.173;
-				
-				if(f == 0)
-				{
-					curr_food_task->computeTorques(bottom_bun_command_torques);
-					redis_client.setEigenMatrixJSON(BOTTOM_BUN_TORQUES_COMMANDED_KEY, bottom_bun_command_torques + g_food);
-					if(controller_counter % 10000 == 0){
-					cout << "bottom_bun_actuate = " << bottom_bun_actuate << "... bottom_bun_command_torques = " << bottom_bun_command_torques.transpose() << endl << endl;
-					}
-				}
+				// food torques are sent with the arm torques at the end of the tick
+				curr_food_task->computeTorques(food_task_torques);
+				food_command_torques.segment<6>(6 * plate_column[f]) = food_task_torques + g_food;
+			}
+		}
+			
+//-----------------------------------------------*******STACKING FOOD CONTROL********---------------------------------------------------------
+		phase_timer.update(time, world.sim_time, task, grill_index, plate_index);
 
-				else if(f == 1)
-				{
-					curr_food_task->computeTorques(burger_command_torques);
-					redis_client.setEigenMatrixJSON(BURGER_TORQUES_COMMANDED_KEY, burger_command_torques + g_food);
-					if(controller_counter % 10000 == 0){
-					cout << "burger_actuate = " << burger_actuate << "... burger_command_torques = " << burger_command_torques.transpose() << endl << endl;
-					}
-				}
-				else if(f == 2)
+		// end of the allocation free part of the tick. sending (and the debug
+		// prints below) may allocate in hiredis and iostream
+		alloc_counter.end();
+
+		// send torques to the simulation
+		{
+			TRACE_SCOPE("send torques");
+			for (int f = 0; f < NUM_RECIPE_FOODS; f++)
+			{
+				if (food_actuate[f] && controller_counter % 10000 == 0)
 				{
-					curr_food_task->computeTorques(top_bun_command_torques);
-					redis_client.setEigenMatrixJSON(TOP_BUN_TORQUES_COMMANDED_KEY, top_bun_command_torques + g_food);
-					if(controller_counter % 10000 == 0){
-					cout << "top_bun_actuate = " << top_bun_actuate << "... top_bun_command_torques = " << top_bun_command_torques.transpose() << endl << endl;
-					}
+					cout << plate_order[f] << " command torques = "
+						 << food_command_torques.segment<6>(6 * plate_column[f]).transpose() << endl << endl;
 				}
 			}
-			
-			
+			transport.set(FOOD_TORQUES_COMMANDED_KEY, food_command_torques, world.seq);
+			transport.set(JOINT_TORQUES_COMMANDED_KEY, command_torques, world.seq);
+			if (state != phase.state || task != phase.task || station != phase.station ||
+				gripper_state != phase.gripper_state || grill_index != phase.grill_index ||
+				plate_index != phase.plate_index)
+			{
+				phase.state = state;
+				phase.task = task;
+				phase.station = station;
+				phase.gripper_state = gripper_state;
+				phase.grill_index = grill_index;
+				phase.plate_index = plate_index;
+				phase.relax_counter = relax_counter;
+				for (int f = 0; f < NUM_RECIPE_FOODS; f++)
+					phase.food_actuate(f) = food_actuate[f];
+				phase.desired_position = posori_task->_desired_position;
+				phase.desired_orientation = posori_task->_desired_orientation;
+				phase.velocity_saturation = posori_task->_use_velocity_saturation_flag;
+				phase.linear_saturation_velocity = posori_task->_linear_saturation_velocity;
+				packControllerCheckpoint(phase, controller_state_buf);
+				transport.set(CONTROLLER_STATE_KEY, controller_state_buf, world.seq);
+			}
+			transport.flush();
 		}
-			
-//-----------------------------------------------*******STACKING FOOD CONTROL********---------------------------------------------------------
-		// send to redis
-		redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEY, command_torques);
 
 		controller_counter++;
+		loop_stats.loopEnd();
+		TRACE_DUMP_IF_REQUESTED(trace_file, "controller");
 	}
+	phase_timer.finish();
+	TRACE_DUMP(trace_file, "controller");
+	model_updater.stop();
 
 	double end_time = timer.elapsedTime();
     std::cout << "\n";
     std::cout << "Controller Loop run time  : " << end_time << " seconds\n";
-    std::cout << "Controller Loop updates   : " << timer.elapsedCycles() << "\n";
-    std::cout << "Controller Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+    std::cout << "Controller Loop updates   : " << controller_counter << "\n";
+    std::cout << "Controller Loop frequency : " << controller_counter/end_time << "Hz\n";
+    if (controller_counter > 0) {
+    	std::cout << "Redis round trips / tick  : " << (double)transport.round_trips / controller_counter << "\n";
+    }
+    std::cout << "Stale world states        : " << stale_world_states << "\n";
+    std::cout << "Missed world states       : " << missed_world_states << "\n";
+    std::cout << "Simulation real time      : " << world.rtf << " (last real time factor of simviz)\n";
+    loop_stats.print();
+    model_updater.print();
+    alloc_counter.print();
+    std::cout << "Burgers per minute        : " << phase_timer.burgersPerMinute() << " (simulated time)\n";
+    if (phase_timer.writeCsv(phase_report_csv) && phase_timer.writeJson(phase_report_json)) {
+    	std::cout << "Phase report              : " << phase_report_csv << ", " << phase_report_json << "\n";
+    }
+    if (phase_timer.droppedRecords() > 0 || phase_timer.droppedBurgers() > 0) {
+    	std::cout << "Phase records dropped     : " << phase_timer.droppedRecords() << " records, "
+    			  << phase_timer.droppedBurgers() << " burgers (more than " << PHASE_TIMER_CAPACITY << ")\n";
+    }
 
 	return 0;
 }
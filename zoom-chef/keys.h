@@ -0,0 +1,28 @@
+#ifndef _KEYS_H
+#define _KEYS_H
+
+// redis keys shared by simviz_zoom_chef and controller_zoom_chef
+
+// - sensors (written by the simulation)
+// the whole world state, published once per physics step. see world_state.h
+constexpr const char *WORLD_STATE_KEY = "sai2::cs225a::project::sensors::world_state";
+
+// - actuators (written by the controller)
+constexpr const char *JOINT_TORQUES_COMMANDED_KEY = "sai2::cs225a::project::actuators::fgc";
+// joint torques of all foods, 6 per food in the column order of scene.h
+constexpr const char *FOOD_TORQUES_COMMANDED_KEY = "sai2::cs225a::project::actuators::foods";
+// state machine of the controller, only written when its phase changes. see
+// checkpoint.h
+constexpr const char *CONTROLLER_STATE_KEY = "sai2::cs225a::project::controller::state";
+
+// keys exchanged every tick between the two processes. these are the keys
+// that get the binary encoding and a slot in the shared memory segment
+constexpr int NUM_HOT_KEYS = 4;
+constexpr const char *HOT_KEYS[NUM_HOT_KEYS] = {
+	WORLD_STATE_KEY,
+	JOINT_TORQUES_COMMANDED_KEY,
+	FOOD_TORQUES_COMMANDED_KEY,
+	CONTROLLER_STATE_KEY,
+};
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef _LOOP_STATS_H
+#define _LOOP_STATS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Log-linear histogram of durations in nanoseconds, in the spirit of
+// HdrHistogram: every power of two is split into 16 linear buckets, so the
+// relative error of a reported value is below 1/16 (6 %) from 1 ns up to
+// 2^43 ns (~2.4 hours). Longer durations land in the last bucket, max() stays
+// exact. Recording is a few instructions and never allocates.
+class LatencyHistogram
+{
+public:
+	static constexpr int NUM_BUCKETS = 640;
+
+	LatencyHistogram() { reset(); }
+
+	void reset()
+	{
+		memset(_counts, 0, sizeof(_counts));
+		_count = 0;
+		_max = 0;
+	}
+
+	void record(int64_t ns)
+	{
+		uint64_t value = ns > 0 ? (uint64_t) ns : 0;
+		int index = bucketIndex(value);
+		if (index >= NUM_BUCKETS)
+			index = NUM_BUCKETS - 1;
+		_counts[index]++;
+		_count++;
+		if (value > _max)
+			_max = value;
+	}
+
+	uint64_t count() const { return _count; }
+	uint64_t max() const { return _max; }
+
+	// upper bound of the bucket holding the given quantile (0..1)
+	uint64_t quantile(double q) const
+	{
+		if (_count == 0)
+			return 0;
+		uint64_t target = (uint64_t) (q * _count);
+		if (target >= _count)
+			target = _count - 1;
+		uint64_t seen = 0;
+		for (int i = 0; i < NUM_BUCKETS; i++)
+		{
+			seen += _counts[i];
+			if (seen > target)
+				return std::min(bucketUpperBound(i), _max);
+		}
+		return _max;
+	}
+
+private:
+	static int bucketIndex(uint64_t value)
+	{
+		if (value < 32)
+			return (int) value;
+		int msb = 63 - __builtin_clzll(value);
+		int shift = msb - 4;
+		return shift * 16 + (int) (value >> shift);
+	}
+
+	static uint64_t bucketUpperBound(int index)
+	{
+		if (index < 32)
+			return index;
+		int shift = index / 16 - 1;
+		uint64_t sub = index % 16 + 16;
+		return ((sub + 1) << shift) - 1;
+	}
+
+	uint64_t _counts[NUM_BUCKETS];
+	uint64_t _count;
+	uint64_t _max;
+};
+
+// Period, compute time and overruns of one loop. Call loopStart() right after
+// the loop woke up (with the result of LoopTimer::waitForNextLoop) and
+// loopEnd() when its work is done.
+//
+// A loop overruns when the timer did not have to sleep, or when its period is
+// more than 1.5 times the nominal one (for loops paced by something else, e.g.
+// vsync). Nominal frequency 0 disables overrun detection, e.g. in lockstep.
+//
+// Every report_interval seconds a one line summary of that interval is
+// printed, print() reports the whole run.
+class LoopStats
+{
+public:
+	LoopStats(const std::string& name, double nominal_frequency, double report_interval = 10.0)
+		: _name(name), _report_interval(report_interval)
+	{
+		_nominal_period_ns = nominal_frequency > 0 ? (int64_t) (1e9 / nominal_frequency) : 0;
+	}
+
+	void loopStart(bool timer_slept = true)
+	{
+		int64_t now = nowNs();
+		if (_last_start > 0)
+		{
+			int64_t period = now - _last_start;
+			_period.record(period);
+			_interval_period.record(period);
+			if (_nominal_period_ns > 0 && (!timer_slept || 2 * period > 3 * _nominal_period_ns))
+			{
+				_overruns++;
+				_interval_overruns++;
+			}
+		}
+		else
+		{
+			_interval_start = now;
+		}
+		_last_start = now;
+	}
+
+	void loopEnd()
+	{
+		int64_t now = nowNs();
+		int64_t compute = now - _last_start;
+		_compute.record(compute);
+		_interval_compute.record(compute);
+
+		if (_report_interval > 0 && now - _interval_start > (int64_t) (_report_interval * 1e9))
+		{
+			printLine("", _interval_period, _interval_compute, _interval_overruns);
+			_interval_period.reset();
+			_interval_compute.reset();
+			_interval_overruns = 0;
+			_interval_start = now;
+		}
+	}
+
+	void print() const
+	{
+		printLine("total ", _period, _compute, _overruns);
+	}
+
+	unsigned long long overruns() const { return _overruns; }
+
+private:
+	static int64_t nowNs()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void printLine(const char* label, const LatencyHistogram& period, const LatencyHistogram& compute,
+				   unsigned long long overruns) const
+	{
+		// formatted apart so the fixed precision does not stick to std::cout
+		std::ostringstream line;
+		line << std::fixed << std::setprecision(1) << _name << " loop " << label << "period us p50 "
+			 << period.quantile(0.5) * 1e-3 << " p99 " << period.quantile(0.99) * 1e-3 << " p99.9 "
+			 << period.quantile(0.999) * 1e-3 << " max " << period.max() * 1e-3 << " | compute us p50 "
+			 << compute.quantile(0.5) * 1e-3 << " p99 " << compute.quantile(0.99) * 1e-3 << " p99.9 "
+			 << compute.quantile(0.999) * 1e-3 << " max " << compute.max() * 1e-3 << " | overruns " << overruns
+			 << " of " << period.count();
+		std::cout << line.str() << std::endl;
+	}
+
+	std::string _name;
+	double _report_interval;
+	int64_t _nominal_period_ns;
+	int64_t _last_start = 0;
+	int64_t _interval_start = 0;
+
+	LatencyHistogram _period;
+	LatencyHistogram _compute;
+	unsigned long long _overruns = 0;
+
+	LatencyHistogram _interval_period;
+	LatencyHistogram _interval_compute;
+	unsigned long long _interval_overruns = 0;
+};
+
+#endif
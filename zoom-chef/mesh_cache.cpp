@@ -0,0 +1,72 @@
+// Offline step of the zoom-chef build (ZOOM_CHEF_MESH_CACHE): converts an OBJ
+// mesh to the binary cache format of mesh_cache.h, which simviz maps at startup
+// instead of parsing the OBJ text.
+//
+//   mesh_cache_zoom_chef input.obj output.zcm
+//
+// Prints the time to parse the OBJ and to map and check the written cache.
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "mesh_cache.h"
+
+using namespace std;
+
+double elapsedMs(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 3)
+	{
+		cout << "usage: " << argv[0] << " input.obj output.zcm" << endl;
+		return 1;
+	}
+	string input = argv[1], output = argv[2];
+
+	string text;
+	MeshSourceStamp stamp;
+	if (!meshSourceStamp(input, stamp) || !readFileBytes(input, text))
+	{
+		cout << "Could not read mesh " << input << endl;
+		return 1;
+	}
+	uint64_t source_hash = meshHash(text.data(), text.size());
+	size_t slash = input.find_last_of('/');
+
+	auto start = chrono::steady_clock::now();
+	CachedMesh mesh;
+	if (!mesh.parseObj(text, slash == string::npos ? "" : input.substr(0, slash + 1)))
+	{
+		cout << "Could not parse mesh " << input << endl;
+		return 1;
+	}
+	double parse_ms = elapsedMs(start);
+	if (!mesh.write(output, stamp, source_hash))
+	{
+		cout << "Could not write mesh cache " << output << endl;
+		return 1;
+	}
+
+	start = chrono::steady_clock::now();
+	CachedMesh check;
+	string reason;
+	if (!check.map(output, reason) || !(check.source_stamp == stamp))
+	{
+		if (reason.empty())
+			reason = "wrong OBJ file stamp";
+		cout << "Written mesh cache " << output << " does not load: " << reason << endl;
+		return 1;
+	}
+	double map_ms = elapsedMs(start);
+	printf("%s: %u vertices, %u triangles, %u groups, %zu -> %zu bytes, parse %.1f ms, map %.2f ms\n", input.c_str(),
+		   mesh.num_vertices, mesh.num_triangles, mesh.num_groups, text.size(),
+		   sizeof(MeshCacheHeader) + mesh.num_groups * sizeof(MeshCacheGroup) + mesh.num_vertices * 6 * sizeof(float) +
+			   mesh.num_triangles * 3 * sizeof(uint32_t),
+		   parse_ms, map_ms);
+	return 0;
+}
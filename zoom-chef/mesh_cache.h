@@ -0,0 +1,443 @@
+#ifndef _MESH_CACHE_H
+#define _MESH_CACHE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Binary cache of a triangle mesh, written offline from an OBJ file
+// (mesh_cache.cpp, ZOOM_CHEF_MESH_CACHE) and memory mapped at startup instead
+// of parsing the OBJ text. A .zcm file is
+//
+//   MeshCacheHeader
+//   MeshCacheGroup   groups[num_groups]      one per material
+//   float            positions[3 * num_vertices]
+//   float            normals[3 * num_vertices]
+//   uint32_t         indices[3 * num_triangles]
+//
+// in native byte order. Vertices and triangles are stored group by group, the
+// indices of a group count from its first vertex. The header holds the size,
+// modification time and FNV-1a hash of the OBJ file it was made from, and the
+// hash of everything after the header. At startup the OBJ is only hashed when
+// its size or time differ from the stamp (it was touched or copied): a cache
+// whose OBJ changed, or that is truncated or corrupt, is rejected and the OBJ
+// is parsed instead.
+
+#define MESH_CACHE_VERSION 2
+
+struct MeshCacheHeader
+{
+	char magic[8];             // "ZCMESH"
+	uint32_t version;
+	uint32_t num_vertices;
+	uint32_t num_triangles;
+	uint32_t num_groups;
+	uint64_t source_hash;      // of the OBJ file
+	uint64_t data_hash;        // of the bytes after the header
+	float bounds_min[3];
+	float bounds_max[3];
+	uint64_t source_size;      // of the OBJ file in bytes
+	int64_t source_mtime;      // of the OBJ file in ns since the epoch
+};
+
+struct MeshCacheGroup
+{
+	uint32_t first_vertex;
+	uint32_t num_vertices;
+	uint32_t first_triangle;
+	uint32_t num_triangles;
+	float color[4];            // diffuse color and opacity of the material
+	uint32_t has_color;
+	char material[28];         // usemtl name, truncated
+};
+
+static_assert(sizeof(MeshCacheHeader) == 80, "mesh cache header layout");
+static_assert(sizeof(MeshCacheGroup) == 64, "mesh cache group layout");
+
+inline uint64_t meshHash(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+	const unsigned char* bytes = (const unsigned char*) data;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ULL;
+	return hash;
+}
+
+// size and modification time of a file, the cheap check of a cache source
+struct MeshSourceStamp
+{
+	uint64_t size = 0;
+	int64_t mtime = 0;
+
+	bool operator==(const MeshSourceStamp& other) const { return size == other.size && mtime == other.mtime; }
+};
+
+inline bool meshSourceStamp(const std::string& path, MeshSourceStamp& stamp)
+{
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+		return false;
+	stamp.size = info.st_size;
+	stamp.mtime = (int64_t) info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+	return true;
+}
+
+inline bool readFileBytes(const std::string& path, std::string& bytes)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+	std::stringstream contents;
+	contents << file.rdbuf();
+	bytes = contents.str();
+	return true;
+}
+
+// a mesh as flat arrays, mapped from a cache file or parsed from an OBJ file
+class CachedMesh
+{
+public:
+	CachedMesh() {}
+	CachedMesh(const CachedMesh&) = delete;
+	CachedMesh& operator=(const CachedMesh&) = delete;
+	~CachedMesh() { unmap(); }
+
+	uint32_t num_vertices = 0;
+	uint32_t num_triangles = 0;
+	uint32_t num_groups = 0;
+	const float* positions = nullptr;
+	const float* normals = nullptr;
+	const uint32_t* indices = nullptr;
+	const MeshCacheGroup* groups = nullptr;
+	float bounds_min[3] = {0, 0, 0};
+	float bounds_max[3] = {0, 0, 0};
+	MeshSourceStamp source_stamp;  // of the OBJ file, set by map()
+	uint64_t source_hash = 0;
+
+	bool mapped() const { return _map != nullptr; }
+
+	// map a cache file and check it is complete. whether it was made from the
+	// current OBJ file is up to the caller, see source_stamp and source_hash. on
+	// failure reason says why
+	bool map(const std::string& path, std::string& reason)
+	{
+		unmap();
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			reason = "no cache file";
+			return false;
+		}
+		struct stat info;
+		void* data = MAP_FAILED;
+		if (fstat(fd, &info) == 0 && info.st_size >= (off_t) sizeof(MeshCacheHeader))
+			data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED)
+		{
+			reason = "cache file too small";
+			return false;
+		}
+		_map = data;
+		_map_size = info.st_size;
+
+		const MeshCacheHeader* header = (const MeshCacheHeader*) data;
+		const char* body = (const char*) data + sizeof(MeshCacheHeader);
+		size_t body_size = (size_t) header->num_groups * sizeof(MeshCacheGroup) +
+						   (size_t) header->num_vertices * 6 * sizeof(float) +
+						   (size_t) header->num_triangles * 3 * sizeof(uint32_t);
+		if (strncmp(header->magic, "ZCMESH", 8) != 0 || header->version != MESH_CACHE_VERSION)
+			reason = "not a version " + std::to_string(MESH_CACHE_VERSION) + " mesh cache";
+		else if (sizeof(MeshCacheHeader) + body_size != _map_size)
+			reason = "cache file size does not match its header";
+		else if (meshHash(body, body_size) != header->data_hash)
+			reason = "cache data corrupt";
+		else
+			reason.clear();
+		if (!reason.empty())
+		{
+			unmap();
+			return false;
+		}
+
+		num_vertices = header->num_vertices;
+		num_triangles = header->num_triangles;
+		num_groups = header->num_groups;
+		groups = (const MeshCacheGroup*) body;
+		positions = (const float*) (groups + num_groups);
+		normals = positions + 3 * num_vertices;
+		indices = (const uint32_t*) (normals + 3 * num_vertices);
+		memcpy(bounds_min, header->bounds_min, sizeof(bounds_min));
+		memcpy(bounds_max, header->bounds_max, sizeof(bounds_max));
+		source_stamp.size = header->source_size;
+		source_stamp.mtime = header->source_mtime;
+		source_hash = header->source_hash;
+		return true;
+	}
+
+	// parse the text of an OBJ file. dir is where its material libraries are.
+	// faces are fan triangulated, vertices without normals get area weighted
+	// ones, texture coordinates are dropped
+	bool parseObj(const std::string& text, const std::string& dir)
+	{
+		unmap();
+		std::vector<float> v, vn;
+		std::map<std::string, int> material_index;
+		std::vector<std::string> materials(1, "");
+		std::map<std::string, std::vector<float> > colors;
+
+		// triangles per material, as (position, normal) corners
+		std::vector<std::vector<std::pair<int, int> > > corners(1);
+		int material = 0;
+		std::stringstream lines(text);
+		std::string line;
+		while (getline(lines, line))
+		{
+			std::stringstream tokens(line);
+			std::string type;
+			tokens >> type;
+			if (type == "v" || type == "vn")
+			{
+				float x = 0, y = 0, z = 0;
+				tokens >> x >> y >> z;
+				std::vector<float>& target = type == "v" ? v : vn;
+				target.insert(target.end(), {x, y, z});
+			}
+			else if (type == "f")
+			{
+				std::vector<std::pair<int, int> > face;
+				std::string corner;
+				while (tokens >> corner)
+				{
+					int p = atoi(corner.c_str());
+					int n = 0;
+					size_t slash = corner.rfind('/');
+					if (slash != std::string::npos && corner.find('/') != slash)
+						n = atoi(corner.c_str() + slash + 1);  // v/vt/vn or v//vn
+					p = p < 0 ? (int) v.size() / 3 + p : p - 1;
+					n = n < 0 ? (int) vn.size() / 3 + n : n - 1;
+					face.push_back(std::make_pair(p, n));
+				}
+				for (size_t i = 2; i < face.size(); i++)
+					corners[material].insert(corners[material].end(), {face[0], face[i - 1], face[i]});
+			}
+			else if (type == "usemtl")
+			{
+				std::string name;
+				tokens >> name;
+				auto found = material_index.find(name);
+				if (found == material_index.end())
+				{
+					found = material_index.insert(std::make_pair(name, (int) materials.size())).first;
+					materials.push_back(name);
+					corners.emplace_back();
+				}
+				material = found->second;
+			}
+			else if (type == "mtllib")
+			{
+				std::string name;
+				tokens >> name;
+				readMaterialColors(dir + name, colors);
+			}
+		}
+		int num_positions = v.size() / 3;
+		for (auto& group : corners)
+			for (auto& c : group)
+				if (c.first < 0 || c.first >= num_positions)
+					return false;
+
+		// normals of positions that come without one
+		std::vector<float> smooth(v.size(), 0.0f);
+		for (auto& group : corners)
+			for (size_t t = 0; t + 2 < group.size(); t += 3)
+			{
+				const float* a = &v[3 * group[t].first];
+				const float* b = &v[3 * group[t + 1].first];
+				const float* c = &v[3 * group[t + 2].first];
+				float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+				float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+				float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+				for (int k = 0; k < 3; k++)
+					for (int d = 0; d < 3; d++)
+						smooth[3 * group[t + k].first + d] += n[d];
+			}
+
+		_positions.clear();
+		_normals.clear();
+		_indices.clear();
+		_groups.clear();
+		for (size_t g = 0; g < corners.size(); g++)
+		{
+			if (corners[g].empty())
+				continue;
+			MeshCacheGroup group;
+			memset(&group, 0, sizeof(group));
+			group.first_vertex = _positions.size() / 3;
+			group.first_triangle = _indices.size() / 3;
+			strncpy(group.material, materials[g].c_str(), sizeof(group.material) - 1);
+			auto color = colors.find(materials[g]);
+			if (color != colors.end())
+			{
+				group.has_color = 1;
+				memcpy(group.color, color->second.data(), sizeof(group.color));
+			}
+			std::map<std::pair<int, int>, uint32_t> vertex;
+			for (auto& c : corners[g])
+			{
+				auto inserted = vertex.insert(std::make_pair(c, (uint32_t) vertex.size()));
+				if (inserted.second)
+				{
+					_positions.insert(_positions.end(), &v[3 * c.first], &v[3 * c.first] + 3);
+					bool has_normal = c.second >= 0 && c.second < (int) vn.size() / 3;
+					const float* n = has_normal ? &vn[3 * c.second] : &smooth[3 * c.first];
+					float norm = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+					for (int d = 0; d < 3; d++)
+						_normals.push_back(norm > 0 ? n[d] / norm : (d == 2));
+				}
+				_indices.push_back(inserted.first->second);
+			}
+			group.num_vertices = vertex.size();
+			group.num_triangles = corners[g].size() / 3;
+			_groups.push_back(group);
+		}
+
+		num_vertices = _positions.size() / 3;
+		num_triangles = _indices.size() / 3;
+		num_groups = _groups.size();
+		positions = _positions.data();
+		normals = _normals.data();
+		indices = _indices.data();
+		groups = _groups.data();
+		for (int d = 0; d < 3; d++)
+		{
+			bounds_min[d] = num_vertices > 0 ? positions[d] : 0;
+			bounds_max[d] = bounds_min[d];
+		}
+		for (uint32_t i = 0; i < num_vertices; i++)
+			for (int d = 0; d < 3; d++)
+			{
+				bounds_min[d] = std::min(bounds_min[d], positions[3 * i + d]);
+				bounds_max[d] = std::max(bounds_max[d], positions[3 * i + d]);
+			}
+		return true;
+	}
+
+	bool write(const std::string& path, const MeshSourceStamp& stamp, uint64_t hash) const
+	{
+		MeshCacheHeader header;
+		memset(&header, 0, sizeof(header));
+		strncpy(header.magic, "ZCMESH", sizeof(header.magic));
+		header.version = MESH_CACHE_VERSION;
+		header.num_vertices = num_vertices;
+		header.num_triangles = num_triangles;
+		header.num_groups = num_groups;
+		header.source_hash = hash;
+		header.source_size = stamp.size;
+		header.source_mtime = stamp.mtime;
+		memcpy(header.bounds_min, bounds_min, sizeof(bounds_min));
+		memcpy(header.bounds_max, bounds_max, sizeof(bounds_max));
+
+		size_t sizes[4] = {num_groups * sizeof(MeshCacheGroup), 3 * num_vertices * sizeof(float),
+						   3 * num_vertices * sizeof(float), 3 * num_triangles * sizeof(uint32_t)};
+		const void* parts[4] = {groups, positions, normals, indices};
+		header.data_hash = 14695981039346656037ULL;
+		for (int i = 0; i < 4; i++)
+			header.data_hash = meshHash(parts[i], sizes[i], header.data_hash);
+
+		std::ofstream file(path, std::ios::binary);
+		file.write((const char*) &header, sizeof(header));
+		for (int i = 0; i < 4; i++)
+			file.write((const char*) parts[i], sizes[i]);
+		return (bool) file;
+	}
+
+private:
+	// Kd and d of every material of an .mtl file
+	static void readMaterialColors(const std::string& path, std::map<std::string, std::vector<float> >& colors)
+	{
+		std::ifstream file(path);
+		std::string line, material;
+		while (getline(file, line))
+		{
+			std::stringstream tokens(line);
+			std::string type;
+			tokens >> type;
+			if (type == "newmtl")
+			{
+				tokens >> material;
+				colors[material] = {0.8f, 0.8f, 0.8f, 1.0f};
+			}
+			else if (type == "Kd" && !material.empty())
+				tokens >> colors[material][0] >> colors[material][1] >> colors[material][2];
+			else if (type == "d" && !material.empty())
+				tokens >> colors[material][3];
+		}
+	}
+
+	void unmap()
+	{
+		if (_map != nullptr)
+			munmap(_map, _map_size);
+		_map = nullptr;
+		_map_size = 0;
+		source_stamp = MeshSourceStamp();
+		source_hash = 0;
+	}
+
+	void* _map = nullptr;
+	size_t _map_size = 0;
+	std::vector<float> _positions, _normals;
+	std::vector<uint32_t> _indices;
+	std::vector<MeshCacheGroup> _groups;
+};
+
+// load obj_file through its cache: map cache_file if it was made from the
+// current contents of obj_file, else parse obj_file. the OBJ file is only read
+// when its size or modification time differ from the stamp in the cache.
+// returns false if neither works
+inline bool loadCachedMesh(const std::string& obj_file, const std::string& cache_file, CachedMesh& mesh)
+{
+	std::string text, reason;
+	MeshSourceStamp stamp;
+	if (!meshSourceStamp(obj_file, stamp))
+	{
+		std::cout << "Could not read mesh " << obj_file << std::endl;
+		return false;
+	}
+	bool have_text = false;
+	if (mesh.map(cache_file, reason))
+	{
+		if (mesh.source_stamp == stamp)
+			return true;
+		// touched or copied since the cache was written, compare the contents
+		have_text = readFileBytes(obj_file, text);
+		if (have_text && meshHash(text.data(), text.size()) == mesh.source_hash)
+			return true;
+		reason = "OBJ file changed since the cache was written";
+	}
+	if (!have_text && !readFileBytes(obj_file, text))
+	{
+		std::cout << "Could not read mesh " << obj_file << std::endl;
+		return false;
+	}
+	std::cout << "Mesh cache " << cache_file << ": " << reason << ", parsing " << obj_file << std::endl;
+	size_t slash = obj_file.find_last_of('/');
+	return mesh.parseObj(text, slash == std::string::npos ? "" : obj_file.substr(0, slash + 1));
+}
+
+#endif
@@ -0,0 +1,304 @@
+// Offline step of the zoom-chef build (ZOOM_CHEF_VISUAL_LOD): writes decimated
+// levels of detail of a visual mesh, which simviz shows instead of the full
+// mesh when the object is far from the camera (mesh_lod.h).
+//
+//   mesh_lod_zoom_chef [--ratio R]... input.obj output_dir
+//
+// --ratio R  vertex count of the next level as a fraction of the input
+//            (default 0.25 and 0.06, so two levels)
+//
+// Level k is written to output_dir/<name>_lod<k>.obj. Decimation is vertex
+// clustering: vertices are merged per cell of a uniform grid, whose cell size
+// is searched to hit the vertex budget. Vertices only merge when their normals
+// point the same way (same dominant axis), so both sides of thin parts like the
+// spatula blade or the cheese slice survive. Materials are kept, texture
+// coordinates are dropped, and so are the texture maps of the copied .mtl files
+// (the build leaves textured meshes alone).
+
+#include <Eigen/Dense>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+using namespace Eigen;
+
+struct Mesh
+{
+	vector<Vector3d> vertices;
+	vector<Vector3i> triangles;  // 0 based vertex indices
+	vector<int> triangle_material;
+	vector<string> materials;    // usemtl names
+	vector<string> material_libs;
+};
+
+bool readObj(const string& path, Mesh& mesh)
+{
+	ifstream file(path);
+	if (!file)
+		return false;
+	int material = -1;
+	string line;
+	while (getline(file, line))
+	{
+		stringstream tokens(line);
+		string type;
+		tokens >> type;
+		if (type == "v")
+		{
+			Vector3d v;
+			tokens >> v(0) >> v(1) >> v(2);
+			mesh.vertices.push_back(v);
+		}
+		else if (type == "f")
+		{
+			vector<int> face;
+			string corner;
+			while (tokens >> corner)
+			{
+				int index = atoi(corner.c_str());  // stops at the first '/'
+				face.push_back(index < 0 ? (int) mesh.vertices.size() + index : index - 1);
+			}
+			// fan triangulation
+			for (size_t i = 2; i < face.size(); i++)
+			{
+				mesh.triangles.push_back(Vector3i(face[0], face[i - 1], face[i]));
+				mesh.triangle_material.push_back(material);
+			}
+		}
+		else if (type == "usemtl")
+		{
+			string name;
+			tokens >> name;
+			auto found = find(mesh.materials.begin(), mesh.materials.end(), name);
+			material = found - mesh.materials.begin();
+			if (found == mesh.materials.end())
+				mesh.materials.push_back(name);
+		}
+		else if (type == "mtllib")
+		{
+			string name;
+			tokens >> name;
+			mesh.material_libs.push_back(name);
+		}
+	}
+	return true;
+}
+
+// area weighted vertex normals
+vector<Vector3d> vertexNormals(const Mesh& mesh)
+{
+	vector<Vector3d> normals(mesh.vertices.size(), Vector3d::Zero());
+	for (const Vector3i& t : mesh.triangles)
+	{
+		Vector3d n = (mesh.vertices[t(1)] - mesh.vertices[t(0)]).cross(mesh.vertices[t(2)] - mesh.vertices[t(0)]);
+		for (int k = 0; k < 3; k++)
+			normals[t(k)] += n;
+	}
+	for (Vector3d& n : normals)
+		if (n.norm() > 0)
+			n.normalize();
+	return normals;
+}
+
+// one of six directions, the dominant axis of the normal and its sign
+int normalBucket(const Vector3d& normal)
+{
+	int axis;
+	normal.cwiseAbs().maxCoeff(&axis);
+	return 2 * axis + (normal(axis) < 0);
+}
+
+typedef tuple<long, long, long, int> CellKey;
+
+struct CellKeyHash
+{
+	size_t operator()(const CellKey& key) const
+	{
+		return ((get<0>(key) * 73856093L) ^ (get<1>(key) * 19349663L) ^ (get<2>(key) * 83492791L)) * 8 + get<3>(key);
+	}
+};
+
+// cluster of every vertex for a grid of cell size, returns the cluster count
+int clusterVertices(const Mesh& mesh, const vector<Vector3d>& normals, const Vector3d& origin, double cell,
+					vector<int>& cluster)
+{
+	unordered_map<CellKey, int, CellKeyHash> cells;
+	cluster.resize(mesh.vertices.size());
+	for (size_t i = 0; i < mesh.vertices.size(); i++)
+	{
+		Vector3d c = (mesh.vertices[i] - origin) / cell;
+		CellKey key(floor(c(0)), floor(c(1)), floor(c(2)), normalBucket(normals[i]));
+		auto inserted = cells.insert(make_pair(key, (int) cells.size()));
+		cluster[i] = inserted.first->second;
+	}
+	return cells.size();
+}
+
+// copy of a material library without texture maps, the levels have no texture
+// coordinates
+void copyMaterialLib(const string& input_dir, const string& output_dir, const string& name)
+{
+	ifstream in(input_dir + name);
+	if (!in)
+	{
+		cout << "  material library " << input_dir + name << " not found, skipped" << endl;
+		return;
+	}
+	ofstream out(output_dir + name);
+	string line;
+	while (getline(in, line))
+		if (line.compare(0, 4, "map_") != 0)
+			out << line << "\n";
+}
+
+bool writeLevel(const Mesh& mesh, const vector<Vector3d>& normals, const vector<int>& cluster, int num_clusters,
+				const string& path, const string& comment)
+{
+	// cluster representatives, mean position and normal of the members
+	vector<Vector3d> positions(num_clusters, Vector3d::Zero()), cluster_normals(num_clusters, Vector3d::Zero());
+	vector<int> members(num_clusters, 0);
+	for (size_t i = 0; i < mesh.vertices.size(); i++)
+	{
+		positions[cluster[i]] += mesh.vertices[i];
+		cluster_normals[cluster[i]] += normals[i];
+		members[cluster[i]]++;
+	}
+
+	// surviving triangles per material, degenerate and duplicate ones dropped
+	map<int, vector<Vector3i> > triangles;
+	set<tuple<int, int, int> > seen;
+	vector<int> used(num_clusters, -1);
+	int num_used = 0, num_triangles = 0;
+	for (size_t i = 0; i < mesh.triangles.size(); i++)
+	{
+		Vector3i t(cluster[mesh.triangles[i](0)], cluster[mesh.triangles[i](1)], cluster[mesh.triangles[i](2)]);
+		if (t(0) == t(1) || t(1) == t(2) || t(2) == t(0))
+			continue;
+		// same triangle with the same orientation, whatever the first corner
+		int first = t(0) < t(1) ? (t(0) < t(2) ? 0 : 2) : (t(1) < t(2) ? 1 : 2);
+		if (!seen.insert(make_tuple(t(first), t((first + 1) % 3), t((first + 2) % 3))).second)
+			continue;
+		for (int k = 0; k < 3; k++)
+			if (used[t(k)] < 0)
+				used[t(k)] = num_used++;
+		triangles[mesh.triangle_material[i]].push_back(t);
+		num_triangles++;
+	}
+	vector<int> order(num_used);
+	for (int c = 0; c < num_clusters; c++)
+		if (used[c] >= 0)
+			order[used[c]] = c;
+
+	ofstream out(path);
+	if (!out)
+		return false;
+	out << "# " << comment << ", " << num_used << " vertices, " << num_triangles << " faces\n";
+	for (const string& lib : mesh.material_libs)
+		out << "mtllib " << lib << "\n";
+	for (int c : order)
+		out << "v " << positions[c](0) / members[c] << " " << positions[c](1) / members[c] << " "
+			<< positions[c](2) / members[c] << "\n";
+	for (int c : order)
+	{
+		Vector3d n = cluster_normals[c].norm() > 0 ? cluster_normals[c].normalized() : Vector3d::UnitZ();
+		out << "vn " << n(0) << " " << n(1) << " " << n(2) << "\n";
+	}
+	for (const auto& group : triangles)
+	{
+		if (group.first >= 0)
+			out << "usemtl " << mesh.materials[group.first] << "\n";
+		for (const Vector3i& t : group.second)
+		{
+			out << "f";
+			for (int k = 0; k < 3; k++)
+				out << " " << used[t(k)] + 1 << "//" << used[t(k)] + 1;
+			out << "\n";
+		}
+	}
+	cout << "  " << path << ": " << num_used << " vertices, " << num_triangles << " faces" << endl;
+	return (bool) out;
+}
+
+int main(int argc, char** argv)
+{
+	vector<double> ratios;
+	vector<string> files;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--ratio" && i + 1 < argc)
+			ratios.push_back(atof(argv[++i]));
+		else
+			files.push_back(arg);
+	}
+	if (ratios.empty())
+		ratios = {0.25, 0.06};
+	if (files.size() != 2)
+	{
+		cout << "usage: " << argv[0] << " [--ratio R]... input.obj output_dir" << endl;
+		return 1;
+	}
+
+	Mesh mesh;
+	if (!readObj(files[0], mesh) || mesh.vertices.empty())
+	{
+		cout << "Could not read mesh " << files[0] << endl;
+		return 1;
+	}
+	size_t slash = files[0].find_last_of('/');
+	string input_dir = slash == string::npos ? "" : files[0].substr(0, slash + 1);
+	string stem = files[0].substr(input_dir.size());
+	stem = stem.substr(0, stem.rfind(".obj"));
+	string output_dir = files[1].back() == '/' ? files[1] : files[1] + "/";
+	cout << files[0] << ": " << mesh.vertices.size() << " vertices, " << mesh.triangles.size() << " faces" << endl;
+
+	for (const string& lib : mesh.material_libs)
+		copyMaterialLib(input_dir, output_dir, lib);
+
+	vector<Vector3d> normals = vertexNormals(mesh);
+	Vector3d lo = mesh.vertices[0], hi = mesh.vertices[0];
+	for (const Vector3d& v : mesh.vertices)
+	{
+		lo = lo.cwiseMin(v);
+		hi = hi.cwiseMax(v);
+	}
+	double size = max((hi - lo).maxCoeff(), 1e-12);
+
+	for (size_t level = 0; level < ratios.size(); level++)
+	{
+		// bisect the cell size (on a log scale) for the vertex budget
+		int budget = max(8, (int) (ratios[level] * mesh.vertices.size()));
+		double small = size * 1e-4, large = size;
+		vector<int> cluster;
+		for (int iteration = 0; iteration < 24; iteration++)
+		{
+			double cell = sqrt(small * large);
+			if (clusterVertices(mesh, normals, lo, cell, cluster) > budget)
+				small = cell;
+			else
+				large = cell;
+		}
+		int num_clusters = clusterVertices(mesh, normals, lo, large, cluster);
+
+		stringstream comment;
+		comment << "level of detail " << level + 1 << " of " << files[0] << ", ratio " << ratios[level];
+		string path = output_dir + stem + "_lod" + to_string(level + 1) + ".obj";
+		if (!writeLevel(mesh, normals, cluster, num_clusters, path, comment.str()))
+		{
+			cout << "Could not write mesh " << path << endl;
+			return 1;
+		}
+	}
+	return 0;
+}
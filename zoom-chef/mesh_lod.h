@@ -0,0 +1,368 @@
+#ifndef _MESH_LOD_H
+#define _MESH_LOD_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+#include "Sai2Graphics.h"
+
+#include "scene.h"
+#ifdef USING_MESH_CACHE
+#include "mesh_cache.h"
+#endif
+
+// Distance based level of detail for the visual meshes of the graphics scene.
+// The build (ZOOM_CHEF_VISUAL_LOD) writes decimated levels of every zoom-chef
+// visual mesh to resources/visual_lod (mesh_lod.cpp). Sai2Graphics only loads
+// the full meshes, so the levels are loaded here, attached next to the full
+// mesh in the chai3d scene graph of Sai2Graphics and all but one are hidden.
+// Before every frame the render loop picks the level of each visual from the
+// distance between the camera and the link or static object it belongs to.
+//
+// With ZOOM_CHEF_MESH_CACHE the installed urdfs point Sai2Graphics to one
+// triangle placeholders instead of the full meshes. The full mesh is then loaded
+// here as level 0, and all levels come from the binary mesh cache
+// (mesh_cache.h) rather than from OBJ text.
+//
+// Sai2Graphics names the chai3d objects of robots, links and static objects
+// after the world and urdf files and leaves the visual meshes unnamed, in the
+// order of the <visual> tags. A visual whose object can not be matched that way
+// keeps its full mesh, or with the mesh cache its placeholder, so it is not
+// drawn (reported at startup).
+
+// one <visual> mesh of a urdf link or of a world file static object
+struct LodVisual
+{
+	std::string object;       // robot or static object name
+	std::string link;         // link name, empty for static objects
+	int index;                // position among the visuals of the link or object
+	std::string mesh;         // mesh file as given in the file
+	Eigen::Vector3d scale;
+};
+
+struct MeshLodParams
+{
+	std::vector<double> distances = {1.5, 3.0};  // m from the camera where level 1, 2, ... start
+	double hysteresis = 0.1;                     // relative band around a distance where the level holds
+};
+
+// group and name of a zoom-chef visual mesh from its path in a urdf or world
+// file, .../zoom-chef/<group>/meshes/visual/<name>.obj or the placeholder
+// mesh_cache/<group>/<name>.obj. false if the mesh is not from this repository
+inline bool visualMeshName(const std::string& mesh, std::string& group, std::string& name)
+{
+	size_t start = mesh.find("zoom-chef/");
+	size_t end = mesh.find("/meshes/visual/");
+	size_t name_start;
+	if (start != std::string::npos && end != std::string::npos && end > start)
+	{
+		start += 10;
+		name_start = end + 15;
+	}
+	else if ((start = mesh.find("mesh_cache/")) != std::string::npos &&
+			 (end = mesh.find('/', start + 11)) != std::string::npos)
+	{
+		start += 11;
+		name_start = end + 1;
+	}
+	else
+		return false;
+	size_t extension = mesh.rfind(".obj");
+	if (extension == std::string::npos || extension < name_start)
+		return false;
+	group = mesh.substr(start, end - start);
+	name = mesh.substr(name_start, extension - name_start);
+	return true;
+}
+
+// OBJ file of level k of a visual mesh, level 0 is the full mesh
+inline std::string lodMeshFile(const std::string& group, const std::string& name, int level)
+{
+	if (level == 0)
+		return "./resources/../../../zoom-chef/" + group + "/meshes/visual/" + name + ".obj";
+	return "./resources/visual_lod/" + group + "/" + name + "_lod" + std::to_string(level) + ".obj";
+}
+
+// binary cache of the same level (mesh_cache.h)
+inline std::string lodCacheFile(const std::string& group, const std::string& name, int level)
+{
+	return "./resources/mesh_cache/" + group + "/" + name + (level == 0 ? "" : "_lod" + std::to_string(level)) + ".zcm";
+}
+
+#ifdef USING_MESH_CACHE
+// chai3d mesh of a cached mesh, one cMesh per material
+inline chai3d::cMultiMesh* chaiMesh(const CachedMesh& cached)
+{
+	auto multi = new chai3d::cMultiMesh();
+	for (uint32_t g = 0; g < cached.num_groups; g++)
+	{
+		const MeshCacheGroup& group = cached.groups[g];
+		chai3d::cMesh* mesh = multi->newMesh();
+		for (uint32_t i = group.first_vertex; i < group.first_vertex + group.num_vertices; i++)
+		{
+			const float* p = cached.positions + 3 * i;
+			const float* n = cached.normals + 3 * i;
+			unsigned int vertex = mesh->newVertex(p[0], p[1], p[2]);
+			mesh->m_vertices->setNormal(vertex, n[0], n[1], n[2]);
+		}
+		const uint32_t* t = cached.indices + 3 * group.first_triangle;
+		for (uint32_t i = 0; i < group.num_triangles; i++, t += 3)
+			mesh->newTriangle(t[0], t[1], t[2]);
+		if (group.has_color)
+			mesh->m_material->setColorf(group.color[0], group.color[1], group.color[2], group.color[3]);
+	}
+	return multi;
+}
+#endif
+
+// the visual meshes of the <block> elements (link or static_object) of a urdf or
+// world file. for links, object is the robot name of the urdf
+inline bool lodVisuals(const std::string& file, const std::string& block, const std::string& object,
+					   std::vector<LodVisual>& visuals)
+{
+	std::string xml;
+	if (!readSceneFile(file, xml))
+		return false;
+	const std::string open = "<" + block + " ", close = "</" + block + ">";
+	size_t pos = 0;
+	while ((pos = xml.find(open, pos)) != std::string::npos)
+	{
+		size_t tag_end = xml.find('>', pos);
+		if (tag_end == std::string::npos)
+			break;
+		std::string tag = xml.substr(pos, tag_end - pos);
+		pos = tag_end;
+		if (tag.back() == '/')
+			continue;  // <link name="..."/>
+		size_t end = xml.find(close, pos);
+		if (end == std::string::npos)
+			break;
+		std::string body = xml.substr(pos, end - pos);
+		pos = end;
+
+		std::string name = sceneAttribute(tag, "name");
+		int index = 0;
+		size_t visual = 0;
+		while ((visual = body.find("<visual", visual)) != std::string::npos)
+		{
+			size_t visual_end = body.find("</visual>", visual);
+			std::string contents = body.substr(visual, visual_end == std::string::npos ? std::string::npos : visual_end - visual);
+			visual = visual_end;
+			size_t mesh = contents.find("<mesh ");
+			if (mesh != std::string::npos)
+			{
+				std::string mesh_tag = contents.substr(mesh, contents.find('>', mesh) - mesh);
+				LodVisual entry;
+				entry.object = block == "link" ? object : name;
+				entry.link = block == "link" ? name : "";
+				entry.index = index;
+				entry.mesh = sceneAttribute(mesh_tag, "filename");
+				entry.scale = Eigen::Vector3d::Ones();
+				std::stringstream scale(sceneAttribute(mesh_tag, "scale"));
+				scale >> entry.scale(0) >> entry.scale(1) >> entry.scale(2);
+				visuals.push_back(entry);
+			}
+			index++;
+			if (visual == std::string::npos)
+				break;
+		}
+	}
+	return true;
+}
+
+class MeshLod
+{
+public:
+	// load up to num_levels levels of each visual that has them on disk, and
+	// the full mesh of placeholders, and attach them to the graphics scene.
+	// returns the number of visuals handled here
+	int attach(chai3d::cWorld* world, const std::vector<LodVisual>& visuals, int num_levels)
+	{
+		for (const LodVisual& visual : visuals)
+		{
+			std::string group, name;
+			if (!visualMeshName(visual.mesh, group, name))
+				continue;
+			bool placeholder = visual.mesh.find("mesh_cache/") != std::string::npos;
+			int levels = 0;
+			while (levels < num_levels && std::ifstream(lodMeshFile(group, name, levels + 1)))
+				levels++;
+			if (levels == 0 && !placeholder)
+				continue;
+
+			chai3d::cGenericObject* anchor = findObject(world, visual.object);
+			if (anchor != nullptr && !visual.link.empty())
+				anchor = findObject(anchor, visual.link);
+			chai3d::cGenericObject* full = anchor == nullptr ? nullptr : visualMesh(anchor, visual.index);
+			if (full == nullptr)
+			{
+				// a placeholder can not be swapped for its mesh without its
+				// graphics object, the visual is then not drawn at all
+				std::cout << "Level of detail: no graphics object for " << visual.object << " " << visual.link << " "
+						  << visual.mesh << (placeholder ? ", it is not drawn" : ", keeping the full mesh") << std::endl;
+				continue;
+			}
+
+			Entry entry;
+			entry.anchor = anchor;
+			if (!placeholder)
+				entry.levels.push_back(full);
+			for (int level = placeholder ? 0 : 1; level <= levels; level++)
+			{
+				chai3d::cMultiMesh* mesh = loadLevel(group, name, level);
+				if (mesh == nullptr)
+				{
+					std::cout << "Level of detail: could not load " << lodMeshFile(group, name, level)
+							  << (level == 0 ? ", it is not drawn" : "") << std::endl;
+					break;
+				}
+				// the placeholder is only hidden once the full mesh replaces it
+				if (level == 0)
+					full->setShowEnabled(false, true);
+				mesh->scaleXYZ(visual.scale(0), visual.scale(1), visual.scale(2));
+				mesh->setLocalPos(full->getLocalPos());
+				mesh->setLocalRot(full->getLocalRot());
+				mesh->setShowEnabled(level == 0, true);
+				anchor->addChild(mesh);
+				entry.levels.push_back(mesh);
+			}
+			if (!entry.levels.empty())
+				_entries.push_back(entry);
+		}
+		_frames_at_level.assign(num_levels + 1, 0);
+		return _entries.size();
+	}
+
+	// show the level of every visual that matches its distance to the camera.
+	// call once per frame before rendering
+	void update(const Eigen::Vector3d& camera_position, const MeshLodParams& params)
+	{
+		for (Entry& entry : _entries)
+		{
+			double distance = (entry.anchor->getGlobalPos().eigen() - camera_position).norm();
+			int max_level = std::min(entry.levels.size() - 1, params.distances.size());
+			int level = std::min(entry.level, max_level);
+			while (level < max_level && distance > params.distances[level] * (1 + params.hysteresis))
+				level++;
+			while (level > 0 && distance < params.distances[level - 1] * (1 - params.hysteresis))
+				level--;
+			if (level != entry.level)
+			{
+				entry.levels[entry.level]->setShowEnabled(false, true);
+				entry.levels[level]->setShowEnabled(true, true);
+				entry.level = level;
+			}
+			_frames_at_level[level]++;
+		}
+	}
+
+	int size() const { return _entries.size(); }
+
+	// meshes loaded by attach() from the mesh cache and from OBJ text
+	int fromCache() const { return _from_cache; }
+	int parsed() const { return _parsed; }
+
+	// share of visual frames drawn at each level
+	void print() const
+	{
+		unsigned long long total = 0;
+		for (unsigned long long frames : _frames_at_level)
+			total += frames;
+		if (total == 0)
+			return;
+		printf("Level of detail (%d visuals):", size());
+		for (size_t level = 0; level < _frames_at_level.size(); level++)
+			printf(" lod%zu %.1f%%", level, 100.0 * _frames_at_level[level] / total);
+		printf("\n");
+	}
+
+private:
+	struct Entry
+	{
+		chai3d::cGenericObject* anchor;
+		std::vector<chai3d::cGenericObject*> levels;  // levels[0] is the mesh of Sai2Graphics
+		int level = 0;
+	};
+
+	// one level as a chai3d mesh, through the mesh cache if it is built. when
+	// neither the cache nor our OBJ parser can load it, chai3d's own loader is
+	// tried on the OBJ file
+	chai3d::cMultiMesh* loadLevel(const std::string& group, const std::string& name, int level)
+	{
+		std::string file = lodMeshFile(group, name, level);
+#ifdef USING_MESH_CACHE
+		CachedMesh cached;
+		if (loadCachedMesh(file, lodCacheFile(group, name, level), cached))
+		{
+			(cached.mapped() ? _from_cache : _parsed)++;
+			return chaiMesh(cached);
+		}
+#endif
+		auto mesh = new chai3d::cMultiMesh();
+		if (!mesh->loadFromFile(file))
+		{
+			delete mesh;
+			return nullptr;
+		}
+		_parsed++;
+		return mesh;
+	}
+
+	// depth first search by name below root
+	static chai3d::cGenericObject* findObject(chai3d::cGenericObject* root, const std::string& name)
+	{
+		for (unsigned int i = 0; i < root->getNumChildren(); i++)
+		{
+			chai3d::cGenericObject* child = root->getChild(i);
+			if (child->m_name == name)
+				return child;
+			if (chai3d::cGenericObject* found = findObject(child, name))
+				return found;
+		}
+		return nullptr;
+	}
+
+	// the index-th unnamed child, the visual meshes come before any levels
+	// attached here
+	static chai3d::cGenericObject* visualMesh(chai3d::cGenericObject* anchor, int index)
+	{
+		for (unsigned int i = 0; i < anchor->getNumChildren(); i++)
+		{
+			chai3d::cGenericObject* child = anchor->getChild(i);
+			if (child->m_name.empty() && index-- == 0)
+				return child;
+		}
+		return nullptr;
+	}
+
+	std::vector<Entry> _entries;
+	std::vector<unsigned long long> _frames_at_level;
+	int _from_cache = 0;
+	int _parsed = 0;
+};
+
+// distances from ZOOM_CHEF_LOD_DISTANCES, e.g. "1.5,3". "0" turns selection
+// off, the full meshes are drawn
+inline MeshLodParams meshLodParamsFromEnv(const char* variable)
+{
+	MeshLodParams params;
+	const char* value = getenv(variable);
+	if (value == nullptr || std::string(value).empty())
+		return params;
+	params.distances.clear();
+	std::stringstream distances(value);
+	std::string distance;
+	while (getline(distances, distance, ','))
+		if (atof(distance.c_str()) > 0)
+			params.distances.push_back(atof(distance.c_str()));
+	return params;
+}
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef _MODEL_UPDATER_H
+#define _MODEL_UPDATER_H
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <Eigen/Dense>
+#include "Sai2Model.h"
+#include "timer/LoopTimer.h"
+
+#include "trace.h"
+#include "triple_buffer.h"
+
+// Refreshes the robot dynamics (mass matrix and its inverse) at a lower rate
+// than the control loop. Kinematics are still updated every tick, so positions
+// and Jacobians are always current; the mass matrix changes slowly at our
+// speeds.
+//
+// threaded: a worker thread owns a second Sai2Model of the same robot. It picks
+//   up the latest joint state from the control loop, runs updateModel() at the
+//   model rate and hands M and M_inv back. Both directions go through
+//   TripleBuffer, the control loop never waits for the worker.
+// not threaded: every control_frequency / model_frequency ticks the control
+//   loop runs updateModel() itself. Deterministic, used in lockstep mode.
+//
+// model_frequency 0 updates the full model every tick.
+class ModelUpdater
+{
+public:
+	ModelUpdater(const std::string& robot_file, Sai2Model::Sai2Model* robot, double control_frequency,
+				 double model_frequency, bool threaded)
+		: _model_frequency(model_frequency), _threaded(threaded && model_frequency > 0)
+	{
+		_decimation = model_frequency > 0 ? std::max(1, (int) (control_frequency / model_frequency + 0.5)) : 1;
+		if (!_threaded)
+			return;
+
+		_model = new Sai2Model::Sai2Model(robot_file, false);
+		_model->_q = robot->_q;
+		_model->_dq = robot->_dq;
+		_model->updateModel();
+
+		JointState state = {robot->_q, robot->_dq};
+		_state.init(state);
+		Dynamics dynamics = {_model->_M, _model->_M_inv};
+		_dynamics.init(dynamics);
+
+		_running = true;
+		_thread = std::thread(&ModelUpdater::run, this);
+	}
+
+	~ModelUpdater()
+	{
+		stop();
+		delete _model;
+	}
+
+	void stop()
+	{
+		_running = false;
+		if (_thread.joinable())
+			_thread.join();
+	}
+
+	// call every tick after writing the joint state into robot. returns true
+	// when robot got new dynamics, task models should be updated then
+	bool update(Sai2Model::Sai2Model* robot)
+	{
+		if (!_threaded)
+		{
+			if (_ticks++ % _decimation == 0)
+			{
+				robot->updateModel();
+				return true;
+			}
+			robot->updateKinematics();
+			return false;
+		}
+
+		robot->updateKinematics();
+
+		JointState& state = _state.back();
+		state.q = robot->_q;
+		state.dq = robot->_dq;
+		_state.publish();
+
+		if (!_dynamics.update())
+			return false;
+		robot->_M = _dynamics.front().M;
+		robot->_M_inv = _dynamics.front().M_inv;
+		return true;
+	}
+
+	void print() const
+	{
+		if (_model_frequency <= 0)
+			std::cout << "Model updates             : every tick\n";
+		else if (_threaded)
+			std::cout << "Model updates             : " << _model_frequency << " Hz on a worker thread, "
+					  << _worker_updates << " updates\n";
+		else
+			std::cout << "Model updates             : every " << _decimation << " ticks\n";
+	}
+
+private:
+	struct JointState
+	{
+		Eigen::VectorXd q;
+		Eigen::VectorXd dq;
+	};
+
+	struct Dynamics
+	{
+		Eigen::MatrixXd M;
+		Eigen::MatrixXd M_inv;
+	};
+
+	void run()
+	{
+		LoopTimer timer;
+		timer.initializeTimer();
+		timer.setLoopFrequency(_model_frequency);
+		TRACE_THREAD_NAME("model");
+		while (_running)
+		{
+			timer.waitForNextLoop();
+			TRACE_SCOPE("update model (worker)");
+			_state.update();
+			_model->_q = _state.front().q;
+			_model->_dq = _state.front().dq;
+			_model->updateModel();
+
+			Dynamics& dynamics = _dynamics.back();
+			dynamics.M = _model->_M;
+			dynamics.M_inv = _model->_M_inv;
+			_dynamics.publish();
+			_worker_updates++;
+		}
+	}
+
+	double _model_frequency;
+	bool _threaded;
+	int _decimation;
+	unsigned long long _ticks = 0;
+
+	Sai2Model::Sai2Model* _model = nullptr;
+	TripleBuffer<JointState> _state;
+	TripleBuffer<Dynamics> _dynamics;
+	std::atomic<bool> _running{false};
+	std::atomic<unsigned long long> _worker_updates{0};
+	std::thread _thread;
+};
+
+#endif
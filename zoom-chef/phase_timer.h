@@ -0,0 +1,235 @@
+#ifndef _PHASE_TIMER_H
+#define _PHASE_TIMER_H
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Records how long the controller state machine spends in every phase. A new
+// record starts whenever the phase, grill_index or plate_index changes, so every
+// food iteration shows up separately. Times are kept both in wall clock and in
+// simulated time (the simulation may run slower or faster than real time).
+//
+// At shutdown the records are written as CSV (one row per record) and JSON
+// (records plus per-phase totals and burgers per minute).
+//
+// Storage is reserved up front so the controller tick never allocates. Past
+// PHASE_TIMER_CAPACITY records (or burgers) new ones are counted but not
+// stored, and the reports say how many were dropped. The run totals and the
+// burger rates still cover the whole run.
+
+constexpr size_t PHASE_TIMER_CAPACITY = 1024;
+
+struct PhaseRecord
+{
+	int phase;
+	int grill_index;
+	int plate_index;
+	double enter_time;      // wall clock, seconds since controller start
+	double exit_time;
+	double enter_sim_time;  // simulated time of the world state
+	double exit_sim_time;
+	unsigned long long ticks;
+};
+
+class PhaseTimer
+{
+public:
+	// phase_names[i] is the name of phase i, used in the reports
+	PhaseTimer(const char* const phase_names[], int num_phases)
+		: _phase_names(phase_names), _num_phases(num_phases)
+	{
+		_records.reserve(PHASE_TIMER_CAPACITY);
+		_burger_times.reserve(PHASE_TIMER_CAPACITY);
+		_burger_sim_times.reserve(PHASE_TIMER_CAPACITY);
+	}
+
+	// call once per controller tick, after the state machine ran
+	void update(double time, double sim_time, int phase, int grill_index, int plate_index)
+	{
+		if (!_started)
+		{
+			_start_time = time;
+			_start_sim_time = sim_time;
+		}
+		if (!_started || phase != _current.phase || grill_index != _current.grill_index ||
+			plate_index != _current.plate_index)
+		{
+			closeCurrent(time, sim_time);
+			_started = true;
+			_current.phase = phase;
+			_current.grill_index = grill_index;
+			_current.plate_index = plate_index;
+			_current.enter_time = time;
+			_current.enter_sim_time = sim_time;
+			_current.ticks = 0;
+			_current_stored = _records.size() < PHASE_TIMER_CAPACITY;
+			if (_current_stored)
+				_records.push_back(_current);
+			else
+				_dropped_records++;
+		}
+		_current.ticks++;
+		_last_time = time;
+		_last_sim_time = sim_time;
+	}
+
+	// a burger is on the plate
+	void burgerDone(double time, double sim_time)
+	{
+		_burgers++;
+		_last_burger_time = time;
+		_last_burger_sim_time = sim_time;
+		if (_burger_times.size() < PHASE_TIMER_CAPACITY)
+		{
+			_burger_times.push_back(time);
+			_burger_sim_times.push_back(sim_time);
+		}
+	}
+
+	// close the phase that is still open at shutdown
+	void finish()
+	{
+		closeCurrent(_last_time, _last_sim_time);
+	}
+
+	const std::vector<PhaseRecord>& records() const { return _records; }
+
+	// records and burgers that did not fit PHASE_TIMER_CAPACITY
+	unsigned long long droppedRecords() const { return _dropped_records; }
+	unsigned long long droppedBurgers() const { return _burgers - _burger_sim_times.size(); }
+
+	// burgers per minute of simulated time, from the start of the run to the
+	// last finished burger, so the time spent on an unfinished one does not
+	// count
+	double burgersPerMinute() const
+	{
+		double duration = _last_burger_sim_time - _start_sim_time;
+		return _burgers > 0 && duration > 0 ? 60.0 * _burgers / duration : 0;
+	}
+
+	// burgers per minute of wall clock time, up to the last finished burger
+	double burgersPerMinuteWall() const
+	{
+		double duration = _last_burger_time - _start_time;
+		return _burgers > 0 && duration > 0 ? 60.0 * _burgers / duration : 0;
+	}
+
+	double totalSimTime() const
+	{
+		return _started ? _last_sim_time - _start_sim_time : 0;
+	}
+
+	double totalTime() const
+	{
+		return _started ? _last_time - _start_time : 0;
+	}
+
+	bool writeCsv(const std::string& path) const
+	{
+		std::ofstream file(path);
+		if (!file)
+			return false;
+		file << std::setprecision(9);
+		file << "phase,grill_index,plate_index,enter_time,exit_time,duration,enter_sim_time,exit_sim_time,sim_duration,ticks\n";
+		for (const PhaseRecord& r : _records)
+			file << phaseName(r.phase) << "," << r.grill_index << "," << r.plate_index << ","
+				 << r.enter_time << "," << r.exit_time << "," << r.exit_time - r.enter_time << ","
+				 << r.enter_sim_time << "," << r.exit_sim_time << "," << r.exit_sim_time - r.enter_sim_time << ","
+				 << r.ticks << "\n";
+		return (bool) file;
+	}
+
+	bool writeJson(const std::string& path) const
+	{
+		std::ofstream file(path);
+		if (!file)
+			return false;
+		file << std::setprecision(9);
+		file << "{\n";
+		file << "  \"total_time\": " << totalTime() << ",\n";
+		file << "  \"total_sim_time\": " << totalSimTime() << ",\n";
+		file << "  \"burgers\": " << _burgers << ",\n";
+		file << "  \"dropped_records\": " << _dropped_records << ",\n";
+		file << "  \"burgers_per_minute\": " << burgersPerMinute() << ",\n";
+		file << "  \"burgers_per_minute_wall\": " << burgersPerMinuteWall() << ",\n";
+		file << "  \"burger_done_sim_times\": [";
+		for (size_t i = 0; i < _burger_sim_times.size(); i++)
+			file << (i ? ", " : "") << _burger_sim_times[i];
+		file << "],\n";
+
+		file << "  \"phases\": {";
+		bool first = true;
+		for (int phase = 0; phase < _num_phases; phase++)
+		{
+			int count = 0;
+			double duration = 0, sim_duration = 0, max_sim_duration = 0;
+			for (const PhaseRecord& r : _records)
+				if (r.phase == phase)
+				{
+					count++;
+					duration += r.exit_time - r.enter_time;
+					sim_duration += r.exit_sim_time - r.enter_sim_time;
+					max_sim_duration = std::max(max_sim_duration, r.exit_sim_time - r.enter_sim_time);
+				}
+			if (count == 0)
+				continue;
+			file << (first ? "\n" : ",\n");
+			file << "    \"" << phaseName(phase) << "\": {\"count\": " << count << ", \"duration\": " << duration
+				 << ", \"sim_duration\": " << sim_duration << ", \"mean_sim_duration\": " << sim_duration / count
+				 << ", \"max_sim_duration\": " << max_sim_duration << "}";
+			first = false;
+		}
+		file << "\n  },\n";
+
+		file << "  \"records\": [";
+		for (size_t i = 0; i < _records.size(); i++)
+		{
+			const PhaseRecord& r = _records[i];
+			file << (i ? ",\n" : "\n");
+			file << "    {\"phase\": \"" << phaseName(r.phase) << "\", \"grill_index\": " << r.grill_index
+				 << ", \"plate_index\": " << r.plate_index << ", \"enter_time\": " << r.enter_time
+				 << ", \"exit_time\": " << r.exit_time << ", \"enter_sim_time\": " << r.enter_sim_time
+				 << ", \"exit_sim_time\": " << r.exit_sim_time << ", \"ticks\": " << r.ticks << "}";
+		}
+		file << "\n  ]\n}\n";
+		return (bool) file;
+	}
+
+private:
+	const char* phaseName(int phase) const
+	{
+		return (phase >= 0 && phase < _num_phases) ? _phase_names[phase] : "UNKNOWN";
+	}
+
+	void closeCurrent(double time, double sim_time)
+	{
+		if (!_current_stored)
+			return;
+		_current.exit_time = time;
+		_current.exit_sim_time = sim_time;
+		_records.back() = _current;
+	}
+
+	const char* const* _phase_names;
+	int _num_phases;
+	std::vector<PhaseRecord> _records;
+	PhaseRecord _current;
+	bool _current_stored = false;  // _current is _records.back()
+	bool _started = false;
+	double _start_time = 0;
+	double _start_sim_time = 0;
+	double _last_time = 0;
+	double _last_sim_time = 0;
+	unsigned long long _dropped_records = 0;
+	unsigned long long _burgers = 0;
+	double _last_burger_time = 0;
+	double _last_burger_sim_time = 0;
+	std::vector<double> _burger_times;
+	std::vector<double> _burger_sim_times;
+};
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef _REDIS_BINARY_H
+#define _REDIS_BINARY_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <Eigen/Dense>
+#include <hiredis/hiredis.h>
+#include "redis/RedisClient.h"
+
+// Binary wire format for Eigen matrices on the hot redis keys. It replaces the
+// JSON text of setEigenMatrixJSON/getEigenMatrixJSON when the project is built
+// with USING_BINARY_REDIS (cmake -DZOOM_CHEF_BINARY_REDIS=ON). Both executables
+// must be built the same way.
+//
+// layout (all fields little endian):
+//   uint32 rows | uint32 cols | uint32 scalar type | uint32 reserved |
+//   uint64 sequence number | rows * cols doubles, column major
+
+constexpr uint32_t EIGEN_BINARY_SCALAR_DOUBLE = 1;
+constexpr size_t EIGEN_BINARY_HEADER_SIZE = 24;
+
+inline size_t eigenBinarySize(int rows, int cols)
+{
+	return EIGEN_BINARY_HEADER_SIZE + sizeof(double) * rows * cols;
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+inline uint32_t toLittleEndian32(uint32_t x) { return __builtin_bswap32(x); }
+inline uint64_t toLittleEndian64(uint64_t x) { return __builtin_bswap64(x); }
+#else
+inline uint32_t toLittleEndian32(uint32_t x) { return x; }
+inline uint64_t toLittleEndian64(uint64_t x) { return x; }
+#endif
+
+inline void putDoubleLE(char* dst, double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	bits = toLittleEndian64(bits);
+	memcpy(dst, &bits, sizeof(bits));
+}
+
+inline double getDoubleLE(const char* src)
+{
+	uint64_t bits;
+	memcpy(&bits, src, sizeof(bits));
+	bits = toLittleEndian64(bits);
+	double value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+// encode value into out. out keeps its capacity between calls, so once it has
+// grown to the largest payload no further allocation happens
+template<typename Derived>
+void encodeEigenBinary(const Eigen::MatrixBase<Derived>& value, uint64_t seq, std::string& out)
+{
+	const int rows = value.rows();
+	const int cols = value.cols();
+	out.resize(eigenBinarySize(rows, cols));
+	char* p = &out[0];
+
+	uint32_t header32[4] = {toLittleEndian32(rows), toLittleEndian32(cols),
+							toLittleEndian32(EIGEN_BINARY_SCALAR_DOUBLE), 0};
+	uint64_t header_seq = toLittleEndian64(seq);
+	memcpy(p, header32, sizeof(header32));
+	memcpy(p + sizeof(header32), &header_seq, sizeof(header_seq));
+	p += EIGEN_BINARY_HEADER_SIZE;
+
+	for (int j = 0; j < cols; j++)
+		for (int i = 0; i < rows; i++, p += sizeof(double))
+			putDoubleLE(p, value(i, j));
+}
+
+// decode data into value. value is only resized when its shape differs from
+// the payload. returns false on a malformed payload and leaves value untouched
+template<typename Derived>
+bool decodeEigenBinary(const char* data, size_t len, Eigen::PlainObjectBase<Derived>& value, uint64_t* seq = nullptr)
+{
+	if (data == nullptr || len < EIGEN_BINARY_HEADER_SIZE)
+		return false;
+
+	uint32_t header32[4];
+	uint64_t header_seq;
+	memcpy(header32, data, sizeof(header32));
+	memcpy(&header_seq, data + sizeof(header32), sizeof(header_seq));
+	const uint32_t rows = toLittleEndian32(header32[0]);
+	const uint32_t cols = toLittleEndian32(header32[1]);
+	if (toLittleEndian32(header32[2]) != EIGEN_BINARY_SCALAR_DOUBLE || len != eigenBinarySize(rows, cols))
+		return false;
+	if ((Derived::RowsAtCompileTime != Eigen::Dynamic && Derived::RowsAtCompileTime != (int) rows) ||
+		(Derived::ColsAtCompileTime != Eigen::Dynamic && Derived::ColsAtCompileTime != (int) cols))
+		return false;
+
+	if (value.rows() != (int) rows || value.cols() != (int) cols)
+		value.resize(rows, cols);
+
+	const char* p = data + EIGEN_BINARY_HEADER_SIZE;
+	for (uint32_t j = 0; j < cols; j++)
+		for (uint32_t i = 0; i < rows; i++, p += sizeof(double))
+			value(i, j) = getDoubleLE(p);
+
+	if (seq != nullptr)
+		*seq = toLittleEndian64(header_seq);
+	return true;
+}
+
+// SET key to the binary encoding of value. buf is scratch space owned by the caller
+template<typename Derived>
+void setEigenBinary(RedisClient& redis_client, const std::string& key, const Eigen::MatrixBase<Derived>& value,
+					uint64_t seq, std::string& buf)
+{
+	encodeEigenBinary(value, seq, buf);
+	redisReply* reply = (redisReply*) redisCommand(redis_client.context_, "SET %s %b", key.c_str(), buf.data(), buf.size());
+	if (reply != nullptr)
+		freeReplyObject(reply);
+}
+
+// GET key and decode it into value. returns false if the key is missing or malformed
+template<typename Derived>
+bool getEigenBinary(RedisClient& redis_client, const std::string& key, Eigen::PlainObjectBase<Derived>& value,
+					uint64_t* seq = nullptr)
+{
+	redisReply* reply = (redisReply*) redisCommand(redis_client.context_, "GET %s", key.c_str());
+	if (reply == nullptr)
+		return false;
+	bool ok = reply->type == REDIS_REPLY_STRING && decodeEigenBinary(reply->str, reply->len, value, seq);
+	freeReplyObject(reply);
+	return ok;
+}
+
+// queue a binary SET without waiting for the reply. call readPipelinedReplies
+// with the number of queued commands to send them all in one round trip
+template<typename Derived>
+void appendSetEigenBinary(RedisClient& redis_client, const std::string& key, const Eigen::MatrixBase<Derived>& value,
+						  uint64_t seq, std::string& buf)
+{
+	encodeEigenBinary(value, seq, buf);
+	redisAppendCommand(redis_client.context_, "SET %s %b", key.c_str(), buf.data(), buf.size());
+}
+
+// send the commands queued with redisAppendCommand and drop their replies,
+// whatever format the values were encoded in
+inline void readPipelinedReplies(RedisClient& redis_client, int num_commands)
+{
+	for (int i = 0; i < num_commands; i++)
+	{
+		redisReply* reply = nullptr;
+		if (redisGetReply(redis_client.context_, (void**) &reply) != REDIS_OK)
+			break;
+		freeReplyObject(reply);
+	}
+}
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef _RT_PROFILE_H
+#define _RT_PROFILE_H
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <alloca.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Opt-in real-time profile for a loop thread: SCHED_FIFO priority, CPU
+// affinity, mlockall and pre-faulted stack and heap, so the loop is neither
+// preempted by the render loop and other processes nor stalled by page faults.
+//
+// Configured per process with an environment variable (ZOOM_CHEF_CONTROLLER_RT,
+// ZOOM_CHEF_SIMVIZ_RT). Unset or 0 disables it, 1 uses the defaults, otherwise
+// a comma separated list of
+//   priority=N   SCHED_FIFO priority 1..99, 0 keeps normal scheduling
+//   cpu=A[+B..]  pin the thread to these cpus
+//   mlock=0|1    lock all current and future memory
+//   stack_kb=N   stack to pre-fault
+//   heap_mb=N    heap to pre-fault and keep (malloc trimming is turned off)
+// e.g. ZOOM_CHEF_CONTROLLER_RT=priority=80,cpu=2 ./controller_zoom_chef
+//
+// Every step that is not permitted (no CAP_SYS_NICE / rtprio limit, memlock
+// limit, ...) prints a warning and the loop runs without it.
+struct RtProfile
+{
+	bool enabled = false;
+	int priority = 80;
+	std::vector<int> cpus;
+	bool lock_memory = true;
+	size_t prefault_stack = 512 * 1024;
+	size_t prefault_heap = 64 * 1024 * 1024;
+};
+
+inline RtProfile rtProfileFromEnv(const char* variable, int default_priority)
+{
+	RtProfile profile;
+	profile.priority = default_priority;
+	const char* value = getenv(variable);
+	if (value == nullptr || strcmp(value, "") == 0 || strcmp(value, "0") == 0)
+		return profile;
+	profile.enabled = true;
+	if (strcmp(value, "1") == 0)
+		return profile;
+
+	std::stringstream options(value);
+	std::string option;
+	while (getline(options, option, ','))
+	{
+		size_t eq = option.find('=');
+		std::string key = option.substr(0, eq);
+		std::string arg = eq == std::string::npos ? "" : option.substr(eq + 1);
+		if (key == "priority")
+			profile.priority = atoi(arg.c_str());
+		else if (key == "cpu")
+		{
+			std::stringstream cpus(arg);
+			std::string cpu;
+			while (getline(cpus, cpu, '+'))
+				profile.cpus.push_back(atoi(cpu.c_str()));
+		}
+		else if (key == "mlock")
+			profile.lock_memory = atoi(arg.c_str()) != 0;
+		else if (key == "stack_kb")
+			profile.prefault_stack = (size_t) atol(arg.c_str()) * 1024;
+		else if (key == "heap_mb")
+			profile.prefault_heap = (size_t) atol(arg.c_str()) * 1024 * 1024;
+		else
+			std::cout << "Unknown real-time option '" << option << "' in " << variable << std::endl;
+	}
+	return profile;
+}
+
+// touch the stack pages the loop will use, so they are mapped (and locked)
+// before the first tick
+__attribute__((noinline)) inline void rtPrefaultStack(size_t size)
+{
+	volatile char* stack = (volatile char*) alloca(size);
+	long page = sysconf(_SC_PAGESIZE);
+	for (size_t i = 0; i < size; i += page)
+		stack[i] = 0;
+}
+
+// grow the heap by size and keep it: with trimming and mmap disabled, freed
+// memory stays mapped for later allocations
+inline void rtPrefaultHeap(size_t size)
+{
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+	char* heap = (char*) malloc(size);
+	if (heap == nullptr)
+		return;
+	long page = sysconf(_SC_PAGESIZE);
+	for (size_t i = 0; i < size; i += page)
+		heap[i] = 0;
+	free(heap);
+}
+
+// apply the profile to the calling thread. returns false if any step failed
+inline bool applyRtProfile(const RtProfile& profile, const std::string& name)
+{
+	if (!profile.enabled)
+		return true;
+	bool ok = true;
+	std::vector<std::string> steps;
+
+	if (profile.lock_memory)
+	{
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+			steps.push_back("memory locked");
+		else
+		{
+			steps.push_back(std::string("mlockall failed (") + strerror(errno) + ")");
+			ok = false;
+		}
+	}
+	if (profile.prefault_heap > 0)
+	{
+		rtPrefaultHeap(profile.prefault_heap);
+		steps.push_back(std::to_string(profile.prefault_heap / (1024 * 1024)) + " MiB heap pre-faulted");
+	}
+	if (profile.prefault_stack > 0)
+	{
+		rtPrefaultStack(profile.prefault_stack);
+		steps.push_back(std::to_string(profile.prefault_stack / 1024) + " KiB stack pre-faulted");
+	}
+
+	if (!profile.cpus.empty())
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		std::string cpu_list;
+		for (int cpu : profile.cpus)
+		{
+			CPU_SET(cpu, &cpus);
+			cpu_list += " " + std::to_string(cpu);
+		}
+		int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if (err == 0)
+			steps.push_back("pinned to cpu" + cpu_list);
+		else
+		{
+			steps.push_back("pinning to cpu" + cpu_list + " failed (" + strerror(err) + ")");
+			ok = false;
+		}
+	}
+
+	if (profile.priority > 0)
+	{
+		sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = profile.priority;
+		int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (err == 0)
+			steps.push_back("SCHED_FIFO priority " + std::to_string(profile.priority));
+		else
+		{
+			steps.push_back("SCHED_FIFO priority " + std::to_string(profile.priority) + " failed (" + strerror(err) +
+							"), normal scheduling");
+			ok = false;
+		}
+	}
+
+	std::cout << "Real-time profile (" << name << "): ";
+	for (size_t i = 0; i < steps.size(); i++)
+		std::cout << (i ? ", " : "") << steps[i];
+	std::cout << std::endl;
+	if (!ok)
+		std::cout << "Real-time profile (" << name << ") only partially applied, check the rtprio and memlock "
+				  << "limits (ulimit -r, ulimit -l) or run with CAP_SYS_NICE and CAP_IPC_LOCK" << std::endl;
+	return ok;
+}
+
+#endif
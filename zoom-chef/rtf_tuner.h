@@ -0,0 +1,128 @@
+#ifndef _RTF_TUNER_H
+#define _RTF_TUNER_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+// Real-time factor of the simulation, simulated seconds per wall second,
+// tuned from the measured cost of the simulation loop so that the simulation
+// keeps up with its own clock on whatever machine it runs.
+//
+// The loop reports the compute time of every iteration (integrate and
+// everything around it, not the timer sleep) and the simulated time it
+// covered. Every window seconds of wall time the cost of the window, compute
+// seconds per simulated second, goes into an exponential moving average. The
+// target factor is utilization / cost, at which the loop computes for
+// utilization of the wall time. The factor drops to a lower target at once and
+// rises by rise of the gap per window, so it does not chase noise. It stays
+// within [min_rtf, max_rtf].
+//
+// The controller gains were tuned with simviz at a fixed factor of 0.5. The
+// controller runs on the wall clock, so a faster simulated clock leaves it
+// fewer ticks per simulated second. Until the gains are checked at higher
+// factors, tuning stops at RTF_GAINS_CHECKED and the controller warns when the
+// world state reports more (a factor fixed by ZOOM_CHEF_RTF).
+constexpr double RTF_GAINS_CHECKED = 0.5;
+
+struct RtfParams
+{
+	double utilization = 0.6;
+	double ema = 0.2;        // weight of the newest window in the cost average
+	double rise = 0.1;
+	double window = 0.1;     // s of wall time
+	double min_rtf = 0.05;
+	double max_rtf = RTF_GAINS_CHECKED;
+	double initial = 0.5;
+	double fixed = 0;        // fixed factor instead of tuning, 0 tunes
+};
+
+class RtfTuner
+{
+public:
+	RtfTuner(const RtfParams& params) : _params(params)
+	{
+		_rtf = params.fixed > 0 ? params.fixed : params.initial;
+	}
+
+	// factor to advance the simulated clock with
+	double rtf() const { return _rtf; }
+
+	// simulated per wall time of the last window, what the factor achieved
+	double measured() const { return _measured; }
+
+	// compute seconds per simulated second, averaged
+	double cost() const { return _cost; }
+
+	// one loop iteration: its compute time, the simulated time it covered and
+	// the wall time since the previous one. returns true at the end of a
+	// window, when the factor may have changed
+	bool update(double compute, double simulated, double wall)
+	{
+		_window_compute += compute;
+		_window_simulated += simulated;
+		_window_wall += wall;
+		if (_window_wall < _params.window)
+			return false;
+
+		_measured = _window_simulated / _window_wall;
+		_total_simulated += _window_simulated;
+		_total_wall += _window_wall;
+		_min_measured = _windows == 0 ? _measured : std::min(_min_measured, _measured);
+		_max_measured = _windows == 0 ? _measured : std::max(_max_measured, _measured);
+		_windows++;
+		if (_window_simulated > 0)
+		{
+			double cost = _window_compute / _window_simulated;
+			_cost = _cost > 0 ? _params.ema * cost + (1 - _params.ema) * _cost : cost;
+		}
+		_window_compute = _window_simulated = _window_wall = 0;
+
+		if (_params.fixed > 0 || _cost <= 0)
+			return true;
+		double target = std::min(std::max(_params.utilization / _cost, _params.min_rtf), _params.max_rtf);
+		if (target < _rtf)
+			_rtf = target;
+		else
+			_rtf += _params.rise * (target - _rtf);
+		return true;
+	}
+
+	void print() const
+	{
+		if (_windows == 0)
+			return;
+		printf("Real time factor          : %.3f mean, %.3f min, %.3f max (%s), %.3f ms compute per simulated ms\n",
+			   _total_simulated / _total_wall, _min_measured, _max_measured, _params.fixed > 0 ? "fixed" : "tuned", _cost);
+	}
+
+private:
+	RtfParams _params;
+	double _rtf;
+	double _measured = 0;
+	double _cost = 0;
+
+	double _window_compute = 0;
+	double _window_simulated = 0;
+	double _window_wall = 0;
+
+	unsigned long long _windows = 0;
+	double _total_simulated = 0;
+	double _total_wall = 0;
+	double _min_measured = 0;
+	double _max_measured = 0;
+};
+
+// ZOOM_CHEF_RTF: a number fixes the factor, e.g. "0.5" runs at half real time.
+// unset or "auto" tunes it
+inline RtfParams rtfParamsFromEnv(const char* variable)
+{
+	RtfParams params;
+	const char* value = getenv(variable);
+	if (value != nullptr && std::string(value) != "auto" && atof(value) > 0)
+		params.fixed = atof(value);
+	return params;
+}
+
+#endif
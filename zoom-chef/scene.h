@@ -0,0 +1,138 @@
+#ifndef _SCENE_H
+#define _SCENE_H
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+
+// The foods of the kitchen scene, discovered from the world file: every
+// <robot> entry except the ones excluded by name (the arm and the spatula) is a
+// food. Foods are free bodies (see body_pose.h) whose base sits at the <origin>
+// of their entry.
+//
+// Per food data is kept as struct of arrays, column i of every table belongs to
+// food i, in world file order. Both executables load the same world file, so
+// the column order is the same in the world state (r_foods) and in the food
+// torques key.
+struct FoodTable
+{
+	int num_foods = 0;
+
+	// static, from the world file
+	std::vector<std::string> names;
+	std::vector<std::string> files;
+	Eigen::Matrix3Xd offsets;                      // base position in the world
+
+	// state, updated by the simulation loop
+	Eigen::Matrix<double, 6, Eigen::Dynamic> q;    // joint positions
+	Eigen::Matrix3Xd positions;                    // link6 position in the world
+	std::vector<char> torque_applied;              // nonzero torques set in the simulation
+
+	// column of the food called name, -1 if there is none
+	int index(const std::string& name) const
+	{
+		for (int i = 0; i < num_foods; i++)
+			if (names[i] == name)
+				return i;
+		return -1;
+	}
+};
+
+// value of attribute in one xml tag, empty if it is not there
+inline std::string sceneAttribute(const std::string& tag, const std::string& attribute)
+{
+	std::string pattern = " " + attribute + "=\"";
+	size_t start = tag.find(pattern);
+	if (start == std::string::npos)
+		return "";
+	start += pattern.size();
+	size_t end = tag.find('"', start);
+	return end == std::string::npos ? "" : tag.substr(start, end - start);
+}
+
+// contents of a world or urdf file without its comments
+inline bool readSceneFile(const std::string& path, std::string& xml)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		std::cout << "Could not open " << path << std::endl;
+		return false;
+	}
+	std::stringstream contents;
+	contents << file.rdbuf();
+	xml = contents.str();
+
+	size_t comment;
+	while ((comment = xml.find("<!--")) != std::string::npos)
+	{
+		size_t end = xml.find("-->", comment);
+		xml.erase(comment, end == std::string::npos ? std::string::npos : end + 3 - comment);
+	}
+	return true;
+}
+
+// read the foods of world_file into foods. only understands the flat layout of
+// the sai2 world files: <robot name>, then its <model dir path> and <origin xyz>
+// tags, then </robot>. commented out entries are skipped
+inline bool loadFoodTable(const std::string& world_file, const std::vector<std::string>& exclude, FoodTable& foods)
+{
+	std::string xml;
+	if (!readSceneFile(world_file, xml))
+		return false;
+
+	std::vector<std::string> names, files;
+	std::vector<Eigen::Vector3d> offsets;
+	size_t pos = 0;
+	while ((pos = xml.find("<robot ", pos)) != std::string::npos)
+	{
+		size_t end = xml.find("</robot>", pos);
+		if (end == std::string::npos)
+			break;
+		std::string entry = xml.substr(pos, end - pos);
+		pos = end;
+
+		std::string name = sceneAttribute(entry.substr(0, entry.find('>')), "name");
+		bool excluded = false;
+		for (const std::string& other : exclude)
+			excluded = excluded || other == name;
+		if (excluded)
+			continue;
+
+		size_t model = entry.find("<model ");
+		size_t origin = entry.find("<origin ");
+		if (name.empty() || model == std::string::npos)
+		{
+			std::cout << "Skipping malformed robot entry in " << world_file << std::endl;
+			continue;
+		}
+		std::string model_tag = entry.substr(model, entry.find('>', model) - model);
+		Eigen::Vector3d offset = Eigen::Vector3d::Zero();
+		if (origin != std::string::npos)
+		{
+			std::stringstream xyz(sceneAttribute(entry.substr(origin, entry.find('>', origin) - origin), "xyz"));
+			xyz >> offset(0) >> offset(1) >> offset(2);
+		}
+		names.push_back(name);
+		files.push_back(sceneAttribute(model_tag, "dir") + sceneAttribute(model_tag, "path"));
+		offsets.push_back(offset);
+	}
+
+	foods.num_foods = names.size();
+	foods.names = names;
+	foods.files = files;
+	foods.offsets.resize(3, foods.num_foods);
+	for (int i = 0; i < foods.num_foods; i++)
+		foods.offsets.col(i) = offsets[i];
+	foods.q = Eigen::Matrix<double, 6, Eigen::Dynamic>::Zero(6, foods.num_foods);
+	foods.positions = foods.offsets;
+	foods.torque_applied.assign(foods.num_foods, 0);
+	return true;
+}
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef _SHM_TRANSPORT_H
+#define _SHM_TRANSPORT_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Eigen/Dense>
+
+#include "keys.h"
+
+// Shared memory segment (/dev/shm/zoom_chef) used instead of redis between
+// simviz_zoom_chef and controller_zoom_chef on a single host, when built with
+// USING_SHM_TRANSPORT (cmake -DZOOM_CHEF_SHM_TRANSPORT=ON).
+//
+// Every hot redis key in keys.h owns one slot. Each slot has a single writer
+// and is protected by a seqlock: the writer makes the lock counter odd while
+// it copies, readers retry until they see the same even counter before and
+// after their copy. Nobody ever blocks: a reader gives up after
+// SHM_READ_RETRIES attempts, so a writer that died in the middle of a write
+// cannot hang it.
+//
+// Every write also stamps the slot with the steady clock, so a reader can tell
+// a writer that stopped (writerStalled) from one that has not started yet.
+// simviz removes the segment when it shuts down cleanly.
+
+constexpr const char *SHM_SEGMENT_NAME = "/zoom_chef";
+constexpr uint32_t SHM_SEGMENT_MAGIC = 0x7a636866;  // "zchf"
+constexpr uint32_t SHM_SEGMENT_VERSION = 4;
+constexpr int SHM_SLOT_CAPACITY = 512;  // doubles per slot, enough for 64 foods
+constexpr int SHM_READ_RETRIES = 100000;
+constexpr double SHM_WRITER_TIMEOUT = 1.0;  // seconds without a write before a writer counts as stalled
+
+struct alignas(64) ShmSlot
+{
+	std::atomic<uint64_t> lock;  // seqlock counter, odd while a write is in progress
+	uint64_t seq;                // sequence number supplied by the writer
+	std::atomic<int64_t> heartbeat;  // steady clock of the last write in ns, 0 before the first
+	uint32_t rows;
+	uint32_t cols;
+	double data[SHM_SLOT_CAPACITY];
+};
+
+struct ShmSegmentLayout
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_slots;
+	ShmSlot slots[NUM_HOT_KEYS];
+};
+
+class ShmSegment
+{
+public:
+	~ShmSegment()
+	{
+		if (_layout != nullptr)
+			munmap(_layout, sizeof(ShmSegmentLayout));
+		if (_created)
+			shm_unlink(SHM_SEGMENT_NAME);
+	}
+
+	// map the segment. the simulation creates (and resets) it, the controller
+	// attaches to the existing one. returns false if that is not possible
+	bool open(bool create)
+	{
+		int fd = shm_open(SHM_SEGMENT_NAME, create ? (O_CREAT | O_RDWR) : O_RDWR, 0666);
+		if (fd < 0)
+		{
+			std::cout << "Could not open shared memory segment " << SHM_SEGMENT_NAME
+					  << (create ? "" : ", is simviz running?") << std::endl;
+			return false;
+		}
+		if (create && ftruncate(fd, sizeof(ShmSegmentLayout)) != 0)
+		{
+			std::cout << "Could not size shared memory segment " << SHM_SEGMENT_NAME << std::endl;
+			close(fd);
+			return false;
+		}
+		void* addr = mmap(nullptr, sizeof(ShmSegmentLayout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (addr == MAP_FAILED)
+		{
+			std::cout << "Could not map shared memory segment " << SHM_SEGMENT_NAME << std::endl;
+			return false;
+		}
+		_layout = static_cast<ShmSegmentLayout*>(addr);
+
+		if (create)
+		{
+			for (int i = 0; i < NUM_HOT_KEYS; i++)
+			{
+				ShmSlot& slot = _layout->slots[i];
+				slot.lock.store(0, std::memory_order_relaxed);
+				slot.seq = 0;
+				slot.heartbeat.store(0, std::memory_order_relaxed);
+				slot.rows = 0;
+				slot.cols = 0;
+			}
+			_layout->num_slots = NUM_HOT_KEYS;
+			_layout->version = SHM_SEGMENT_VERSION;
+			std::atomic_thread_fence(std::memory_order_release);
+			_layout->magic = SHM_SEGMENT_MAGIC;
+			_created = true;
+		}
+		else if (_layout->magic != SHM_SEGMENT_MAGIC || _layout->version != SHM_SEGMENT_VERSION ||
+				 _layout->num_slots != (uint32_t) NUM_HOT_KEYS)
+		{
+			std::cout << "Shared memory segment " << SHM_SEGMENT_NAME << " has an unexpected layout" << std::endl;
+			munmap(_layout, sizeof(ShmSegmentLayout));
+			_layout = nullptr;
+			return false;
+		}
+		return true;
+	}
+
+	// slot of a hot redis key, or -1 if the key has no slot
+	static int slotIndex(const std::string& key)
+	{
+		for (int i = 0; i < NUM_HOT_KEYS; i++)
+			if (key == HOT_KEYS[i])
+				return i;
+		return -1;
+	}
+
+	template<typename Derived>
+	bool write(int slot_index, const Eigen::MatrixBase<Derived>& value, uint64_t seq)
+	{
+		const int rows = value.rows();
+		const int cols = value.cols();
+		if (_layout == nullptr || slot_index < 0 || rows * cols > SHM_SLOT_CAPACITY)
+			return false;
+
+		ShmSlot& slot = _layout->slots[slot_index];
+		uint64_t lock = slot.lock.load(std::memory_order_relaxed);
+		slot.lock.store(lock + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		slot.seq = seq;
+		slot.rows = rows;
+		slot.cols = cols;
+		for (int j = 0; j < cols; j++)
+			for (int i = 0; i < rows; i++)
+				slot.data[j * rows + i] = value(i, j);
+
+		slot.lock.store(lock + 2, std::memory_order_release);
+		slot.heartbeat.store(steadyNs(), std::memory_order_relaxed);
+		return true;
+	}
+
+	// true if the writer of a slot has written before but not in the last
+	// SHM_WRITER_TIMEOUT seconds
+	bool writerStalled(int slot_index) const
+	{
+		if (_layout == nullptr || slot_index < 0)
+			return false;
+		int64_t heartbeat = _layout->slots[slot_index].heartbeat.load(std::memory_order_relaxed);
+		return heartbeat != 0 && (steadyNs() - heartbeat) * 1e-9 > SHM_WRITER_TIMEOUT;
+	}
+
+	// copy the latest value of a slot. returns false if nothing was written yet,
+	// if the slot holds more than SHM_SLOT_CAPACITY values (a corrupt or
+	// mismatched segment), or if no consistent copy was made in
+	// SHM_READ_RETRIES attempts
+	template<typename Derived>
+	bool read(int slot_index, Eigen::PlainObjectBase<Derived>& value, uint64_t* seq = nullptr)
+	{
+		if (_layout == nullptr || slot_index < 0)
+			return false;
+
+		ShmSlot& slot = _layout->slots[slot_index];
+		uint64_t slot_seq;
+		uint32_t rows, cols;
+		int retries = 0;
+		while (true)
+		{
+			if (retries++ == SHM_READ_RETRIES)
+				return false;
+			uint64_t lock_before = slot.lock.load(std::memory_order_acquire);
+			if (lock_before & 1)
+				continue;
+			if (lock_before == 0)
+				return false;
+
+			slot_seq = slot.seq;
+			rows = slot.rows;
+			cols = slot.cols;
+			if ((uint64_t) rows * cols <= (uint64_t) SHM_SLOT_CAPACITY)
+				memcpy(_scratch, slot.data, sizeof(double) * rows * cols);
+
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (slot.lock.load(std::memory_order_relaxed) == lock_before)
+				break;
+		}
+
+		// a writer never stores that much, _scratch would be read past its end
+		if ((uint64_t) rows * cols > (uint64_t) SHM_SLOT_CAPACITY)
+			return false;
+		if ((Derived::RowsAtCompileTime != Eigen::Dynamic && Derived::RowsAtCompileTime != (int) rows) ||
+			(Derived::ColsAtCompileTime != Eigen::Dynamic && Derived::ColsAtCompileTime != (int) cols))
+			return false;
+		if (value.rows() != (int) rows || value.cols() != (int) cols)
+			value.resize(rows, cols);
+		value = Eigen::Map<const Eigen::MatrixXd>(_scratch, rows, cols);
+		if (seq != nullptr)
+			*seq = slot_seq;
+		return true;
+	}
+
+private:
+	static int64_t steadyNs()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	ShmSegmentLayout* _layout = nullptr;
+	bool _created = false;
+	double _scratch[SHM_SLOT_CAPACITY];
+};
+
+#endif
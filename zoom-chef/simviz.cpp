@@ -1,18 +1,47 @@
 // #include <GL/glew.h>
 #include "Sai2Model.h"
+#ifndef HEADLESS
 #include "Sai2Graphics.h"
+#endif
 #include "Sai2Simulation.h"
 #include <dynamics3d.h>
 #include "redis/RedisClient.h"
 #include "timer/LoopTimer.h"
 
+#ifndef HEADLESS
 #include <GLFW/glfw3.h> //must be loaded after loading opengl/glew
+#endif
 #include <cmath>
+// simviz_zoom_chef_headless: no window, no graphics, no click force widget
+#ifndef HEADLESS
 #include "uiforce/UIForceWidget.h"
+#endif
 
 #include <iostream>
 #include <string>
 
+#include "keys.h"
+#include "transport.h"
+#include "world_state.h"
+#include "trace.h"
+#include "loop_stats.h"
+#include "rt_profile.h"
+#include "triple_buffer.h"
+#include "body_pose.h"
+#include "body_sleep.h"
+#include "adaptive_step.h"
+#include "rtf_tuner.h"
+#include "scene.h"
+#include "startup_loader.h"
+#include "checkpoint.h"
+#include "state_log.h"
+#if (defined(USING_VISUAL_LOD) || defined(USING_MESH_CACHE)) && !defined(HEADLESS)
+#include "mesh_lod.h"
+#endif
+
+#include <chrono>
+#include <thread>
+
 #include <signal.h>
 bool fSimulationRunning = false;
 void sighandler(int){fSimulationRunning = false;}
@@ -28,54 +57,62 @@ const string robot_name = "mmp_panda";
 const string camera_name = "camera_fixed";
 const string spatula_file = "./resources/spatula.urdf";
 const string spatula_name = "spatula"; 
-const string burger_file = "./resources/burger.urdf";
-const string burger_name = "burger"; 
-const string tomato_file = "./resources/tomato.urdf";
-const string tomato_name = "tomato"; 
-const string cheese_file = "./resources/cheese.urdf";
-const string cheese_name = "cheese"; 
-const string lettuce_file = "./resources/lettuce.urdf";
-const string lettuce_name = "lettuce";
-const string top_bun_file = "./resources/top_bun.urdf";
-const string top_bun_name = "top_bun";
-const string bottom_bun_file = "./resources/bottom_bun.urdf";
-const string bottom_bun_name = "bottom_bun"; 
-
-// redis keys:
-// - write:
-const std::string JOINT_ANGLES_KEY = "sai2::cs225a::project::sensors::q";
-const std::string JOINT_VELOCITIES_KEY = "sai2::cs225a::project::sensors::dq";
-const std::string SPATULA_POSITION_KEY = "sai2::cs225a::spatula::sensors::r_spatula";
-const std::string SPATULA_ORIENTATION_KEY = "sai2::cs225a::spatula::sensors::ori_spatula";
-const std::string SPATULA_JOINT_ANGLES_KEY = "sai2::cs225a::spatula::sensors::spatula_q";
-const std::string BURGER_POSITION_KEY = "sai2::cs225a::burger::sensors::r_burger";
-// const std::string BURGER_ORIENTATION_KEY = "sai2::cs225a::burger::sensors::q_burger";
-// const std::string BURGER_JOINT_ANGLES_KEY = "sai2::cs225a::burger::sensors::burger_q";
-const std::string TOMATO_POSITION_KEY = "sai2::cs225a::tomato::sensors::r_tomato";
-const std::string CHEESE_POSITION_KEY = "sai2::cs225a::cheese::sensors::r_cheese";
-const std::string LETTUCE_POSITION_KEY = "sai2::cs225a::lettuce::sensors::r_lettuce";
-const std::string TOP_BUN_POSITION_KEY = "sai2::cs225a::top_bun::sensors::r_top_bun";
-const std::string BOTTOM_BUN_POSITION_KEY = "sai2::cs225a::bottom_bun::sensors::r_bottom_bun";
-
-// - read
-const std::string JOINT_TORQUES_COMMANDED_KEY = "sai2::cs225a::project::actuators::fgc";
-const std::string BOTTOM_BUN_TORQUES_COMMANDED_KEY = "sai2::cs225a::project::actuators::bottom_bun";
-const std::string BURGER_TORQUES_COMMANDED_KEY = "sai2::cs225a::project::actuators::burger";
-const std::string TOP_BUN_TORQUES_COMMANDED_KEY = "sai2::cs225a::project::actuators::top_bun";
+// links of the spatula with collision geometry: blade, center and handle
+const vector<string> spatula_links = {"link6", "link7", "link8"};
+// every other robot of the world file is a food, see scene.h
+
+// chrome trace of the loops (ZOOM_CHEF_TRACE), written at shutdown and on SIGUSR1
+const string trace_file = "zoom_chef_trace_simviz.json";
+
+// fixed physics step of the lockstep mode (USING_LOCKSTEP)
+const double lockstep_dt = 0.001;
+
 RedisClient redis_client;
+HotKeyTransport transport(redis_client);
+
+// foods of the world file, one column per food
+FoodTable foods;
+
+// simulated time of the checkpoint the simulation started from (ZOOM_CHEF_RESTORE)
+double restored_sim_time = 0;
+
+// joint positions of the robot, the spatula and the foods, published by the
+// simulation thread after every step. the render loop draws its own copies of
+// the models from the latest complete snapshot and never reads the models the
+// simulation is updating
+struct PoseSnapshot
+{
+	VectorXd robot_q;
+	VectorXd spatula_q;
+	Matrix<double, 6, Dynamic> food_q;
+};
+TripleBuffer<PoseSnapshot> pose_buffer;
+
+// click force of the UIForceWidget and the joint torques it makes, computed by
+// the render loop on its copy of the robot and applied by the simulation thread
+struct UIForceSnapshot
+{
+	Vector3d force;
+	VectorXd joint_torques;
+};
+TripleBuffer<UIForceSnapshot> ui_force_buffer;
+
+// pose of every body at step i of a recorded run (state_log.h)
+void replayPoses(const StateLog& log, size_t i, PoseSnapshot& poses);
 
 // simulation function prototype
 void simulation(Sai2Model::Sai2Model* robot, 
 				Sai2Model::Sai2Model* spatula, 
-				Sai2Model::Sai2Model* burger, 
-				Sai2Model::Sai2Model* tomato, 
-				Sai2Model::Sai2Model* cheese, 
-				Sai2Model::Sai2Model* lettuce, 
-				Sai2Model::Sai2Model* top_bun,
-				Sai2Model::Sai2Model* bottom_bun, 
-				Simulation::Sai2Simulation* sim, 
-				UIForceWidget *ui_force_widget);
+				Simulation::Sai2Simulation* sim);
+
+// set the bodies of the simulation to the state of a checkpoint file
+bool restoreCheckpoint(const string& path, Simulation::Sai2Simulation* sim);
+
+// write the bodies of the simulation and the controller state to a checkpoint file
+void saveCheckpoint(const string& path, Sai2Model::Sai2Model* robot, Sai2Model::Sai2Model* spatula,
+					Simulation::Sai2Simulation* sim, double sim_time, const VectorXd& controller_state);
 
+#ifndef HEADLESS
 // callback to print glfw errors
 void glfwError(int error, const char* description);
 
@@ -87,6 +124,7 @@ void keySelect(GLFWwindow* window, int key, int scancode, int action, int mods);
 
 // callback when a mouse button is pressed
 void mouseClick(GLFWwindow* window, int button, int action, int mods);
+#endif
 
 // flags for scene camera movement
 bool fTransXp = false;
@@ -98,6 +136,14 @@ bool fTransZn = false;
 bool fRotPanTilt = false;
 bool fRobotLinkSelect = false;
 
+// replay controls (ZOOM_CHEF_REPLAY): space pauses, [ and ] halve and double
+// the speed, , and . jump 5 s back and forward, home goes back to the start
+double replay_speed = 1;
+double replay_jump = 0;
+bool fReplayPaused = false;
+bool fReplayRestart = false;
+bool fReplayStatus = false;
+
 int main() {
 	cout << "Loading URDF world model file: " << world_file << endl;
 
@@ -105,54 +151,105 @@ int main() {
 	redis_client = RedisClient();
 	redis_client.connect();
 
+	// hot keys to the controller, see transport.h
+	if (!transport.open(true))
+		return 1;
+	cout << "Controller transport: " << HotKeyTransport::name() << endl;
+
 	// set up signal handler
 	signal(SIGABRT, &sighandler);
 	signal(SIGTERM, &sighandler);
 	signal(SIGINT, &sighandler);
+	TRACE_INSTALL_SIGNAL_HANDLER();
+
+	// foods, discovered from the world file
+	StartupLoader loader;
+	bool have_foods = false;
+	loader.step("food table", [&] { have_foods = loadFoodTable(world_file, {robot_name, spatula_name}, foods); });
+	if (!have_foods)
+		return 1;
+	cout << "Foods: " << foods.num_foods << endl;
+
+	// a recorded run (state_log.h) is replayed instead of simulated. the
+	// simulation world is still loaded but never stepped
+	const char* replay_file = getenv("ZOOM_CHEF_REPLAY");
+	StateLog replay_log;
+	string replay_reason;
+	bool have_replay = false;
+	if (replay_file != nullptr)
+		loader.add("state log", [&] { have_replay = replay_log.map(replay_file, replay_reason); });
+
+	// the graphics scene, the simulation world and the models do not depend on
+	// each other, load them in parallel (startup_loader.h)
+#ifndef HEADLESS
+	Sai2Graphics::Sai2Graphics* graphics = nullptr;
+	loader.add("graphics", [&] { graphics = new Sai2Graphics::Sai2Graphics(world_file, true); });
+#endif
+	Simulation::Sai2Simulation* sim = nullptr;
+	loader.add("simulation", [&] { sim = new Simulation::Sai2Simulation(world_file, false); });
+	Sai2Model::Sai2Model* robot = nullptr;
+	Sai2Model::Sai2Model* spatula = nullptr;
+	loader.add("model " + robot_name, [&] { robot = new Sai2Model::Sai2Model(robot_file, false); });
+	loader.add("model " + spatula_name, [&] { spatula = new Sai2Model::Sai2Model(spatula_file, false); });
+	vector<Sai2Model::Sai2Model*> food_models(foods.num_foods);
+	for (int i = 0; i < foods.num_foods; i++)
+		loader.add("model " + foods.names[i], [&, i] { food_models[i] = new Sai2Model::Sai2Model(foods.files[i], false); });
+#ifndef HEADLESS
+	// copies of the robot and the spatula for the render loop
+	Sai2Model::Sai2Model* render_robot = nullptr;
+	Sai2Model::Sai2Model* render_spatula = nullptr;
+	loader.add("render model " + robot_name, [&] { render_robot = new Sai2Model::Sai2Model(robot_file, false); });
+	loader.add("render model " + spatula_name, [&] { render_spatula = new Sai2Model::Sai2Model(spatula_file, false); });
+#endif
+	loader.wait();
+
+	if (replay_file != nullptr)
+	{
+		if (!replay_reason.empty())
+			cout << "State log " << replay_file << " " << replay_reason << endl;
+		if (!have_replay)
+			return 1;
+		if (replay_log.layout.dof != robot->dof() || replay_log.food_names != foods.names)
+		{
+			cout << "State log " << replay_file << " was recorded with another robot or other foods than "
+				 << world_file << endl;
+			return 1;
+		}
+		cout << "Replaying " << replay_file << ": " << replay_log.size() << " records in " << replay_log.chunks()
+			 << " chunks, " << replay_log.startTime() << " s to " << replay_log.endTime() << " s of simulated time" << endl;
+		if (getenv("ZOOM_CHEF_REPLAY_SPEED") != nullptr)
+			replay_speed = atof(getenv("ZOOM_CHEF_REPLAY_SPEED"));
+	}
 
-	// load graphics scene
-	auto graphics = new Sai2Graphics::Sai2Graphics(world_file, true);
+#ifndef HEADLESS
 	Eigen::Vector3d camera_pos, camera_lookat, camera_vertical;
 	graphics->getCameraPose(camera_name, camera_pos, camera_vertical, camera_lookat);
+#endif
 
-	// load robots
-	auto robot = new Sai2Model::Sai2Model(robot_file, false);
 	robot->updateKinematics();
-
-	auto spatula = new Sai2Model::Sai2Model(spatula_file, false);
 	spatula->updateModel();
 	spatula->updateKinematics();
 
-	auto burger = new Sai2Model::Sai2Model(burger_file, false);
-	burger->updateModel();
-	burger->updateKinematics();
-
-	auto tomato = new Sai2Model::Sai2Model(tomato_file, false);
-	tomato->updateModel();
-	tomato->updateKinematics();
-
-	auto cheese = new Sai2Model::Sai2Model(cheese_file, false);
-	cheese->updateModel();
-	cheese->updateKinematics();
-
-	auto lettuce = new Sai2Model::Sai2Model(lettuce_file, false);
-	lettuce->updateModel();
-	lettuce->updateKinematics();
-
-	auto top_bun = new Sai2Model::Sai2Model(top_bun_file, false);
-	top_bun->updateModel();
-	top_bun->updateKinematics();
-
-	auto bottom_bun = new Sai2Model::Sai2Model(bottom_bun_file, false);
-	bottom_bun->updateModel();
-	bottom_bun->updateKinematics();
+	// the simulation loop reads the object poses straight from their joint
+	// positions (body_pose.h), make sure that agrees with the urdf kinematics
+	vector<Sai2Model::Sai2Model*> objects = food_models;
+	objects.push_back(spatula);
+	for (auto object : objects)
+	{
+		if (!bodyPoseMatches(object, "link6"))
+			cout << "Warning: direct pose of an object disagrees with its urdf kinematics, check body_pose.h" << endl;
+		object->_q.setZero();
+		object->updateKinematics();
+	}
 
-	// load simulation world
-	auto sim = new Simulation::Sai2Simulation(world_file, false);
+	// simulation world
 	sim->setCollisionRestitution(0.1);
 	sim->setCoeffFrictionStatic(0.9);
 	sim->setCoeffFrictionDynamic(0.2);
 
+	// continue a run from a checkpoint (checkpoint.h) instead of the world file
+	if (getenv("ZOOM_CHEF_RESTORE") != nullptr && !restoreCheckpoint(getenv("ZOOM_CHEF_RESTORE"), sim))
+		return 1;
 
 	// read joint positions, velocities, update model
 	sim->getJointPositions(robot_name, robot->_q);
@@ -162,36 +259,46 @@ int main() {
 	//set initial position of spatula in world
 	Eigen::Vector3d r_spatula;
 	Eigen::Matrix3d ori_spatula;
-	// get position and orientation of burger from sim
-	//set initial position of burger in world
-	Eigen::Vector3d r_burger;
-	// Eigen::Matrix3d q_burger;
-	// get position of all other objects in the world
-	Eigen::Vector3d r_tomato;
-	Eigen::Vector3d r_cheese;
-	Eigen::Vector3d r_lettuce;
-	Eigen::Vector3d r_top_bun;
-	Eigen::Vector3d r_bottom_bun;
 
 	spatula->positionInWorld(r_spatula, "link6", Vector3d(0, 0, 0));
 	spatula->rotationInWorld(ori_spatula, "link6");
-	spatula->updateModel();
 
-	burger->positionInWorld(r_burger, "link6", Vector3d(0, 0, 0));
-	// burger->rotationInWorld(q_burger, "link6");
-	burger->updateModel();
-
-	tomato->positionInWorld(r_tomato, "link6", Vector3d(0, 0, 0));
-	tomato->updateModel();
-	cheese->positionInWorld(r_cheese, "link6", Vector3d(0, 0, 0));
-	cheese->updateModel();
-	lettuce->positionInWorld(r_lettuce, "link6", Vector3d(0, 0, 0));
-	lettuce->updateModel();
-	top_bun->positionInWorld(r_top_bun, "link6", Vector3d(0, 0, 0));
-	top_bun->updateModel();
-	bottom_bun->positionInWorld(r_bottom_bun, "link6", Vector3d(0, 0, 0));
-	bottom_bun->updateModel();
+#ifdef HEADLESS
+	loader.print();
+	if (replay_file != nullptr)
+	{
+		// no window to replay in: run every step of the log through the models
+		// as fast as possible, which times the replay
+		auto replay_start = chrono::steady_clock::now();
+		PoseSnapshot poses;
+		for (size_t i = 0; i < replay_log.size(); i++)
+		{
+			replayPoses(replay_log, i, poses);
+			robot->_q = poses.robot_q;
+			robot->updateKinematics();
+			spatula->_q = poses.spatula_q;
+			spatula->updateKinematics();
+			for (int f = 0; f < foods.num_foods; f++)
+			{
+				food_models[f]->_q = poses.food_q.col(f);
+				food_models[f]->updateKinematics();
+			}
+		}
+		double replay_wall = chrono::duration<double>(chrono::steady_clock::now() - replay_start).count();
+		double replay_sim = replay_log.endTime() - replay_log.startTime();
+		cout << "Replayed " << replay_log.size() << " records, " << replay_sim << " s of simulated time in " << replay_wall
+			 << " s (" << replay_sim / max(replay_wall, 1e-9) << " x real time)" << endl;
+		return 0;
+	}
+
+	// no visualization, the simulation runs until it is interrupted
+	fSimulationRunning = true;
+	thread sim_thread(simulation, robot, spatula, sim);
+	sim_thread.join();
+	TRACE_DUMP(trace_file, "simviz");
 
+	return 0;
+#else
 	/*------- Set up visualization -------*/
 	// set up error callback
 	glfwSetErrorCallback(glfwError);
@@ -223,40 +330,140 @@ int main() {
 	glfwSetKeyCallback(window, keySelect);
 	glfwSetMouseButtonCallback(window, mouseClick);
 
-	// init click force widget 
-	auto ui_force_widget = new UIForceWidget(robot_name, robot, graphics);
+	// init click force widget, on the render copy of the robot
+	auto ui_force_widget = new UIForceWidget(robot_name, render_robot, graphics);
 	ui_force_widget->setEnable(false);
 
 	// cache variables
 	double last_cursorx, last_cursory;
 
+	// models drawn by the render loop, updated from pose_buffer: the robot, the
+	// spatula, then the foods. the food models are only used here
+	vector<string> render_names = {robot_name, spatula_name};
+	vector<Sai2Model::Sai2Model*> render_models = {render_robot, render_spatula};
+	render_names.insert(render_names.end(), foods.names.begin(), foods.names.end());
+	render_models.insert(render_models.end(), food_models.begin(), food_models.end());
+	PoseSnapshot initial_poses;
+	initial_poses.robot_q = robot->_q;
+	initial_poses.spatula_q = spatula->_q;
+	initial_poses.food_q = foods.q;
+	pose_buffer.init(initial_poses);
+	UIForceSnapshot initial_ui_force;
+	initial_ui_force.force.setZero();
+	initial_ui_force.joint_torques.setZero(robot->dof());
+	ui_force_buffer.init(initial_ui_force);
+	render_models[0]->_q = robot->_q;
+	render_models[1]->_q = spatula->_q;
+	for (int i = 0; i < foods.num_foods; i++)
+		render_models[2 + i]->_q = foods.q.col(i);
+	for (auto model : render_models)
+		model->updateKinematics();
+
+#if defined(USING_VISUAL_LOD) || defined(USING_MESH_CACHE)
+	// decimated visual meshes for objects far from the camera, and the full
+	// meshes from the binary mesh cache (mesh_lod.h)
+#ifdef USING_VISUAL_LOD
+	const int lod_levels = ZOOM_CHEF_LOD_LEVELS;  // one per ZOOM_CHEF_LOD_RATIOS entry
+#else
+	const int lod_levels = 0;
+#endif
+	vector<LodVisual> lod_visuals;
+	lodVisuals(robot_file, "link", robot_name, lod_visuals);
+	lodVisuals(spatula_file, "link", spatula_name, lod_visuals);
+	for (int i = 0; i < foods.num_foods; i++)
+		lodVisuals(foods.files[i], "link", foods.names[i], lod_visuals);
+	lodVisuals(world_file, "static_object", "", lod_visuals);
+	MeshLod mesh_lod;
+	MeshLodParams lod_params = meshLodParamsFromEnv("ZOOM_CHEF_LOD_DISTANCES");
+	loader.step("visual meshes", [&] { mesh_lod.attach(graphics->_world, lod_visuals, lod_levels); });
+	cout << "Level of detail: " << mesh_lod.size() << " of " << lod_visuals.size() << " visual meshes, "
+		 << mesh_lod.fromCache() << " meshes from the mesh cache and " << mesh_lod.parsed() << " from OBJ" << endl;
+#endif
+
 	// initialize glew
 	// glewInitialize();
 
+	loader.print();
+
 	fSimulationRunning = true;
 
-	redis_client.setEigenMatrixJSON(JOINT_ANGLES_KEY, robot->_q); 
-	redis_client.setEigenMatrixJSON(JOINT_VELOCITIES_KEY, robot->_dq); 
-	redis_client.setEigenMatrixJSON(SPATULA_JOINT_ANGLES_KEY, spatula->_q); 
-	// redis_client.setEigenMatrixJSON(SPATULA_JOINT_ANGLES_KEY, burger->_q); 
+	thread sim_thread;
+	if (replay_file == nullptr)
+		sim_thread = thread(simulation, robot, spatula, sim);
+
+	// replay clock in simulated time, advanced by the wall time of each frame
+	// times the replay speed
+	double replay_time = replay_file != nullptr ? replay_log.startTime() : 0;
+	size_t replay_index = replay_log.size();
+	PoseSnapshot replay_poses;
+	auto replay_frame = chrono::steady_clock::now();
+
+	// render loop statistics, paced by vsync at nominally 60 Hz
+	LoopStats render_stats("Render", 60);
 
-	thread sim_thread(simulation, robot, spatula, burger, tomato, cheese, lettuce, top_bun, bottom_bun, sim, ui_force_widget);
-	
 	// while window is open:
+	TRACE_THREAD_NAME("render");
 	while (!glfwWindowShouldClose(window) && fSimulationRunning)
 	{
+		render_stats.loopStart();
+
 		// update graphics. this automatically waits for the correct amount of time
 		int width, height;
 		glfwGetFramebufferSize(window, &width, &height);
-		graphics->updateGraphics(robot_name, robot);
-		graphics->updateGraphics(spatula_name, spatula);
-		graphics->updateGraphics(burger_name, burger);
-		graphics->updateGraphics(tomato_name, tomato);
-		graphics->updateGraphics(cheese_name, cheese);
-		graphics->updateGraphics(lettuce_name, lettuce);
-		graphics->updateGraphics(top_bun_name, top_bun);
-		graphics->updateGraphics(bottom_bun_name, bottom_bun);
-		graphics->render(camera_name, width, height);
+		{
+			TRACE_SCOPE("update graphics");
+			// latest complete step of the simulation, if there is a new one, or
+			// the step of the log at the replay clock
+			const PoseSnapshot* new_poses = nullptr;
+			if (replay_file != nullptr)
+			{
+				auto now = chrono::steady_clock::now();
+				if (!fReplayPaused)
+					replay_time += replay_speed * chrono::duration<double>(now - replay_frame).count();
+				replay_frame = now;
+				replay_time += replay_jump;
+				replay_jump = 0;
+				if (fReplayRestart)
+					replay_time = replay_log.startTime();
+				fReplayRestart = false;
+				replay_time = min(max(replay_time, replay_log.startTime()), replay_log.endTime());
+				size_t index = replay_log.find(replay_time);
+				if (index != replay_index)
+				{
+					replay_index = index;
+					replayPoses(replay_log, index, replay_poses);
+					new_poses = &replay_poses;
+				}
+				if (fReplayStatus)
+				{
+					cout << "Replay " << replay_time << " s of " << replay_log.endTime() << " s, step "
+						 << replay_log.seq(index) << ", speed " << replay_speed << (fReplayPaused ? ", paused" : "") << endl;
+					fReplayStatus = false;
+				}
+			}
+			else if (pose_buffer.update())
+				new_poses = &pose_buffer.front();
+			if (new_poses != nullptr)
+			{
+				const PoseSnapshot& poses = *new_poses;
+				render_models[0]->_q = poses.robot_q;
+				render_models[1]->_q = poses.spatula_q;
+				for (int i = 0; i < foods.num_foods; i++)
+					render_models[2 + i]->_q = poses.food_q.col(i);
+				for (auto model : render_models)
+					model->updateKinematics();
+			}
+			for (size_t i = 0; i < render_models.size(); i++)
+				graphics->updateGraphics(render_names[i], render_models[i]);
+#if defined(USING_VISUAL_LOD) || defined(USING_MESH_CACHE)
+			mesh_lod.update(camera_pos, lod_params);
+#endif
+		}
+		{
+			TRACE_SCOPE("render");
+			graphics->render(camera_name, width, height);
+		}
+		render_stats.loopEnd();
 
 		// swap buffers
 		glfwSwapBuffers(window);
@@ -352,11 +559,23 @@ int main() {
 				// then drag the mouse over a link to start applying a force to it.
 			}
 		}
+
+		// hand the click force to the simulation thread
+		UIForceSnapshot& ui_force = ui_force_buffer.back();
+		ui_force_widget->getUIForce(ui_force.force);
+		ui_force_widget->getUIJointTorques(ui_force.joint_torques);
+		ui_force_buffer.publish();
 	}
 
 	// stop simulation
 	fSimulationRunning = false;
-	sim_thread.join();
+	if (sim_thread.joinable())
+		sim_thread.join();
+	TRACE_DUMP(trace_file, "simviz");
+	render_stats.print();
+#if defined(USING_VISUAL_LOD) || defined(USING_MESH_CACHE)
+	mesh_lod.print();
+#endif
 
 	// destroy context
 	glfwSetWindowShouldClose(window,GL_TRUE);
@@ -366,53 +585,100 @@ int main() {
 	glfwTerminate();
 
 	return 0;
+#endif
 }
 
 //------------------------------------------------------------------------------
 // void simulation(Sai2Model::Sai2Model* robot, Sai2Model::Sai2Model* spatula, Sai2Model::Sai2Model* burger, Simulation::Sai2Simulation* sim, UIForceWidget *ui_force_widget) {
 void simulation(Sai2Model::Sai2Model* robot, 
 				Sai2Model::Sai2Model* spatula, 
-				Sai2Model::Sai2Model* burger, 
-				Sai2Model::Sai2Model* tomato, 
-				Sai2Model::Sai2Model* cheese, 
-				Sai2Model::Sai2Model* lettuce, 
-				Sai2Model::Sai2Model* top_bun,
-				Sai2Model::Sai2Model* bottom_bun, 
-				Simulation::Sai2Simulation* sim, 
-				UIForceWidget *ui_force_widget) {
+				Simulation::Sai2Simulation* sim) {
 
 
 	int dof = robot->dof();
 
-	VectorXd bottom_bun_command_torques = VectorXd::Zero(6);
-	redis_client.setEigenMatrixJSON(BOTTOM_BUN_TORQUES_COMMANDED_KEY, bottom_bun_command_torques);
-
-	VectorXd burger_command_torques = VectorXd::Zero(6);
-	redis_client.setEigenMatrixJSON(BURGER_TORQUES_COMMANDED_KEY, burger_command_torques);
-
-	VectorXd top_bun_command_torques = VectorXd::Zero(6);
-	redis_client.setEigenMatrixJSON(TOP_BUN_TORQUES_COMMANDED_KEY, top_bun_command_torques);
-
+	// 6 torques per food, food i in segment 6 * i
+	VectorXd food_command_torques = VectorXd::Zero(6 * foods.num_foods);
 	VectorXd command_torques = VectorXd::Zero(dof);
-	redis_client.setEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEY, command_torques);
+
+	transport.set(FOOD_TORQUES_COMMANDED_KEY, food_command_torques);
+	transport.set(JOINT_TORQUES_COMMANDED_KEY, command_torques);
+	// no controller state until the controller publishes one, a value left by an
+	// earlier run would be taken for a phase change
+	transport.set(CONTROLLER_STATE_KEY, VectorXd::Zero(1));
+	transport.flush();
+
+	// with ZOOM_CHEF_CHECKPOINT_DIR the controller state is read with the
+	// torques, and a checkpoint is written whenever it changes (checkpoint.h)
+	const char* checkpoint_dir = getenv("ZOOM_CHEF_CHECKPOINT_DIR");
+	VectorXd controller_state, checkpoint_controller_state;
+	ControllerCheckpoint controller_phase;
+	int num_checkpoints = 0;
+
+	const char* const torque_keys[] = {JOINT_TORQUES_COMMANDED_KEY, FOOD_TORQUES_COMMANDED_KEY, CONTROLLER_STATE_KEY};
+	VectorXd* const torque_values[] = {&command_torques, &food_command_torques, &controller_state};
+	uint64_t torque_seqs[] = {0, 0, 0};
+	const int num_torque_keys = checkpoint_dir != nullptr ? 3 : 2;
+
+	// sensor to torque latency, from publishing a world state until the torques
+	// computed from it are picked up here. the controller tags the arm torques
+	// with the world state seq they were computed from, publish times of recent
+	// world states are kept here indexed by seq
+	const int num_publish_times = 64;
+	chrono::steady_clock::time_point publish_times[num_publish_times];
+	uint64_t last_torque_seq = 0;
+	bool controller_stalled = false;
+	double latency_sum = 0;
+	double latency_max = 0;
+	unsigned long long latency_count = 0;
 
 	// create a timer
 	LoopTimer timer;
 	timer.initializeTimer();
-	// For David's Laptop: slow_down_factor = 3
-	double slow_down_factor = 2;
 	timer.setLoopFrequency(1000); 
-	double last_time = timer.elapsedTime()/slow_down_factor; //secs
+#ifndef USING_LOCKSTEP
+	double owed_time = 0;  // simulated time not paid in whole steps yet
 	bool fTimerDidSleep = true;
+#endif
+
+	// real-time factor of the simulated clock, tuned from the cost of this loop
+	// unless ZOOM_CHEF_RTF fixes it (rtf_tuner.h). in lockstep the controller
+	// sets the pace and the factor is only measured. it is published in the
+	// world state and on the console, nothing here waits on redis
+	RtfTuner rtf_tuner(rtfParamsFromEnv("ZOOM_CHEF_RTF"));
+	double last_iteration_start = timer.elapsedTime();
+	double printed_rtf = 0, last_rtf_print = -1;
+	auto tuneRtf = [&](double compute, double simulated, double wall) {
+		if (!rtf_tuner.update(compute, simulated, wall))
+			return;
+#ifdef USING_LOCKSTEP
+		double rtf = rtf_tuner.measured();
+#else
+		double rtf = rtf_tuner.rtf();
+#endif
+		double now = timer.elapsedTime();
+		if (last_rtf_print < 0 || (now - last_rtf_print >= 1 && fabs(rtf - printed_rtf) > 0.05 * printed_rtf))
+		{
+			printf("Real time factor %.3f (%.3f ms compute per simulated ms)\n", rtf, rtf_tuner.cost());
+			printed_rtf = rtf;
+			last_rtf_print = now;
+		}
+	};
+
+	// physics step size, finer while foods are in contact or things move fast
+	// (adaptive_step.h). ZOOM_CHEF_STEP_DT overrides the step sizes
+	AdaptiveStepParams step_params = adaptiveStepParamsFromEnv("ZOOM_CHEF_STEP_DT");
+	AdaptiveStep stepper;
+	double sim_time = 0;   // simulated time integrated so far
 
 	// init variables
 	VectorXd g(dof);
 
+	// click force from the render loop, see ui_force_buffer
 	Eigen::Vector3d ui_force;
 	ui_force.setZero();
 
-	Eigen::VectorXd ui_force_command_torques;
-	ui_force_command_torques.setZero();
+	Eigen::VectorXd ui_force_command_torques = VectorXd::Zero(dof);
 
 	Eigen::Vector3d r_spatula;
 	Eigen::Matrix3d ori_spatula_local;
@@ -425,160 +691,432 @@ void simulation(Sai2Model::Sai2Model* robot,
 						-1.0, 0.0, 0.0,
 						0.0, 0.0, 1.0;
 
-	Eigen::Vector3d r_burger;
-	// Eigen::Matrix3d q_burger_local;
-	// Eigen::Matrix3d q_burger;
-	Eigen::Vector3d burger_offset;
-
-	burger_offset << 0.5, 0.5, 0.5;
-	// Matrix3d burger_rot_init;
-	// burger_rot_init << 1.0, 0.0, 0.0, 
-	// 					0.0, 1.0, 0.0,
-	// 					0.0, 0.0, 1.0;
-
-
-	Eigen::Vector3d r_bottom_bun = Vector3d::Zero();
-	Eigen::Vector3d bottom_bun_offset;
-	bottom_bun_offset << 0.6, 0.5, 0.5;
-
-	Eigen::Vector3d r_top_bun = Vector3d::Zero();
-	Eigen::Vector3d top_bun_offset;
-	top_bun_offset << 0.7, 0.5, 0.5;
-	
-	Eigen::Vector3d r_lettuce = Vector3d::Zero();
-	Eigen::Vector3d lettuce_offset;
-	lettuce_offset << 0.8, 0.5, 0.5;
-
-	Eigen::Vector3d r_cheese = Vector3d::Zero();
-	Eigen::Vector3d cheese_offset;
-	cheese_offset << 0.9, 0.5, 0.5;
-
-	Eigen::Vector3d r_tomato = Vector3d::Zero();
-	Eigen::Vector3d tomato_offset;
-	tomato_offset << 1.0, 0.5, 0.5;
-
-
-
+	// foods are passive, they are put to sleep while they rest (body_sleep.h)
+	vector<BodySleep> food_sleep(foods.num_foods);
+	BodySleepParams sleep_params;
+	VectorXd food_q = VectorXd::Zero(6);
+	VectorXd food_dq = VectorXd::Zero(6);
+	VectorXd food_torques = VectorXd::Zero(6);
+	const VectorXd zero_food_torques = VectorXd::Zero(6);
+	vector<Vector3d> contact_points, contact_forces;
+	Vector3d spatula_force = Vector3d::Zero();  // net contact force of the last iteration
+
+	// world state record published once per step
+	WorldState world;
+	VectorXd world_state_buf;
+
+	// every published world state to a state log with ZOOM_CHEF_RECORD
+	// (state_log.h), one record per loop iteration
+	StateLogWriter state_log;
+	if (getenv("ZOOM_CHEF_RECORD") != nullptr)
+		state_log.open(getenv("ZOOM_CHEF_RECORD"), dof, foods.names);
+
+
+	// period, compute time and overrun histograms, see loop_stats.h
+#ifdef USING_LOCKSTEP
+	LoopStats loop_stats("Simulation", 0);
+#else
+	LoopStats loop_stats("Simulation", 1000);
+#endif
+
+	// opt-in real-time scheduling of the simulation thread only, the render loop
+	// keeps normal scheduling (ZOOM_CHEF_SIMVIZ_RT, see rt_profile.h)
+	applyRtProfile(rtProfileFromEnv("ZOOM_CHEF_SIMVIZ_RT", 79), "simulation");
+
+	TRACE_THREAD_NAME("simulation");
 	while (fSimulationRunning) {
+#ifdef USING_LOCKSTEP
+		// lockstep: no timer. wait until the controller has answered the last
+		// published world state, then advance by exactly one fixed step
+		{
+			TRACE_SCOPE("wait for torques");
+			transport.getMany(torque_keys, torque_values, num_torque_keys, torque_seqs);
+			while (fSimulationRunning && torque_seqs[0] != world.seq)
+			{
+				if (!controller_stalled && torque_seqs[0] > 0 && transport.writerStalled(JOINT_TORQUES_COMMANDED_KEY))
+				{
+					cout << "Controller stopped publishing torques, waiting for it" << endl;
+					controller_stalled = true;
+				}
+				this_thread::yield();
+				transport.getMany(torque_keys, torque_values, num_torque_keys, torque_seqs);
+			}
+		}
+		if (!fSimulationRunning)
+			break;
+		loop_stats.loopStart();
+		double iteration_start = timer.elapsedTime();
+		double wall_dt = iteration_start - last_iteration_start;
+		last_iteration_start = iteration_start;
+
+		// the fixed step split into steps of at most the adaptive step size
+		int num_steps = max(1, (int) ceil(lockstep_dt / stepper.dt(step_params) - 1e-9));
+		double step_dt = lockstep_dt / num_steps;
+#else
 		fTimerDidSleep = timer.waitForNextLoop();
+		loop_stats.loopStart(fTimerDidSleep);
+		double iteration_start = timer.elapsedTime();
+		double wall_dt = iteration_start - last_iteration_start;
+		last_iteration_start = iteration_start;
+
+		// simulated time owed since the last iteration, paid in whole steps of
+		// the adaptive step size. an iteration that owes less than one step
+		// leaves everything as it is
+		owed_time += rtf_tuner.rtf() * wall_dt;
+		double step_dt = stepper.dt(step_params);
+		int num_steps = min((int) (owed_time / step_dt), step_params.max_steps);
+		if (num_steps == 0)
+		{
+			tuneRtf(timer.elapsedTime() - iteration_start, 0, wall_dt);
+			loop_stats.loopEnd();
+			continue;
+		}
+		owed_time -= num_steps * step_dt;
+		if (owed_time >= step_dt)
+		{
+			stepper.drop(owed_time);
+			owed_time = 0;
+		}
+#endif
+		TRACE_SCOPE("step");
 
 		// get gravity torques
 		robot->gravityVector(g);
 
 		// g.setZero();
-		// read arm torques from redis and apply to simulated robot
-		command_torques = redis_client.getEigenMatrixJSON(JOINT_TORQUES_COMMANDED_KEY);
-		bottom_bun_command_torques = redis_client.getEigenMatrixJSON(BOTTOM_BUN_TORQUES_COMMANDED_KEY);
-		burger_command_torques = redis_client.getEigenMatrixJSON(BURGER_TORQUES_COMMANDED_KEY);
-		top_bun_command_torques = redis_client.getEigenMatrixJSON(TOP_BUN_TORQUES_COMMANDED_KEY);
-
+		// read arm torques from the controller and apply to simulated robot
+#ifndef USING_LOCKSTEP
+		{
+			TRACE_SCOPE("read torques");
+			transport.getMany(torque_keys, torque_values, num_torque_keys, torque_seqs);
+		}
+#endif
+		if (torque_seqs[0] > last_torque_seq && torque_seqs[0] + num_publish_times > world.seq)
+		{
+			double latency = chrono::duration<double>(chrono::steady_clock::now() - publish_times[torque_seqs[0] % num_publish_times]).count();
+			latency_sum += latency;
+			latency_max = max(latency_max, latency);
+			latency_count++;
+		}
+		// a controller that stopped publishing leaves its last torques in the
+		// transport. drop them and hold the robot against gravity until it is
+		// back. seq 0 is the value written above, before any controller
+		if (torque_seqs[0] != last_torque_seq)
+			controller_stalled = false;
+		else if (!controller_stalled && torque_seqs[0] > 0 && transport.writerStalled(JOINT_TORQUES_COMMANDED_KEY))
+		{
+			cout << "Controller stopped publishing torques, holding the robot against gravity" << endl;
+			controller_stalled = true;
+		}
+		if (controller_stalled)
+		{
+			command_torques.setZero();
+			food_command_torques.setZero();
+		}
+		last_torque_seq = torque_seqs[0];
 		
-		ui_force_widget->getUIForce(ui_force);
-		ui_force_widget->getUIJointTorques(ui_force_command_torques);
+		if (ui_force_buffer.update())
+		{
+			ui_force = ui_force_buffer.front().force;
+			ui_force_command_torques = ui_force_buffer.front().joint_torques;
+		}
 
 		if (fRobotLinkSelect)
 			sim->setJointTorques(robot_name, command_torques + ui_force_command_torques + g);
 		else
 			sim->setJointTorques(robot_name, command_torques + g);
 
-		sim->setJointTorques(bottom_bun_name, bottom_bun_command_torques);
-		sim->setJointTorques(burger_name, burger_command_torques);
-		sim->setJointTorques(top_bun_name, top_bun_command_torques);
-
+		// food torques, only handed to the engine for foods that get (or just
+		// stopped getting) some
+		if (food_command_torques.size() != 6 * foods.num_foods)
+			food_command_torques.setZero(6 * foods.num_foods);
+		for (int i = 0; i < foods.num_foods; i++)
+		{
+			if (!food_command_torques.segment<6>(6 * i).isZero(0))
+			{
+				food_torques = food_command_torques.segment<6>(6 * i);
+				sim->setJointTorques(foods.names[i], food_torques);
+				foods.torque_applied[i] = 1;
+			}
+			else if (foods.torque_applied[i])
+			{
+				sim->setJointTorques(foods.names[i], zero_food_torques);
+				foods.torque_applied[i] = 0;
+			}
+		}
 
 
-		// integrate forward
 
-		double curr_time = timer.elapsedTime() / slow_down_factor;
-		double loop_dt = curr_time - last_time; 
-		sim->integrate(loop_dt);
+		// integrate forward, torques are held over the steps
+		double loop_dt = num_steps * step_dt;
+		{
+			TRACE_SCOPE("integrate");
+			for (int i = 0; i < num_steps; i++)
+				sim->integrate(step_dt);
+		}
+		stepper.count(num_steps, step_dt);
+		sim_time += loop_dt;
 
 		// read joint positions, velocities, update model
-		sim->getJointPositions(robot_name, robot->_q);
-		sim->getJointVelocities(robot_name, robot->_dq);
-		robot->updateModel();
-
-		// update joint positions for the spatula
-		sim->getJointPositions(spatula_name, spatula->_q);
-		sim->getJointVelocities(spatula_name, spatula->_dq);
-		spatula->updateModel();
-
-		spatula->positionInWorld(r_spatula, "link6");
-		spatula->rotationInWorld(ori_spatula_local, "link6");
-		r_spatula += spatula_offset;
-		ori_spatula = ori_spatula_local * spatula_rot_init;
-		spatula->updateModel();
-
-		// update joint positions for the burger
-		sim->getJointPositions(burger_name, burger->_q);
-		sim->getJointVelocities(burger_name, burger->_dq);
-		burger->updateModel();
-
-		burger->positionInWorld(r_burger, "link6");
-		// burger->rotationInWorld(q_burger_local, "link6");
-		r_burger += burger_offset;
-		// q_burger = q_burger_local * burger_rot_init;
-		// burger->updateModel();
-
-		// update graphics and positions for all other objects
-		sim->getJointPositions(tomato_name, tomato->_q);
-		sim->getJointVelocities(tomato_name, tomato->_dq);
-		tomato->updateModel();
-		tomato->positionInWorld(r_tomato, "link6");
-		r_tomato += tomato_offset;
-
-		sim->getJointPositions(cheese_name, cheese->_q);
-		sim->getJointVelocities(cheese_name, cheese->_dq);
-		cheese->updateModel();
-		cheese->positionInWorld(r_cheese, "link6");
-		r_cheese += cheese_offset;
-
-		sim->getJointPositions(lettuce_name, lettuce->_q);
-		sim->getJointVelocities(lettuce_name, lettuce->_dq);
-		lettuce->updateModel();
-		lettuce->positionInWorld(r_lettuce, "link6");
-		r_lettuce += lettuce_offset;
-
-		sim->getJointPositions(top_bun_name, top_bun->_q);
-		sim->getJointVelocities(top_bun_name, top_bun->_dq);
-		top_bun->updateModel();
-		top_bun->positionInWorld(r_top_bun, "link6");
-		r_top_bun += top_bun_offset;
-
-		sim->getJointPositions(bottom_bun_name, bottom_bun->_q);
-		sim->getJointVelocities(bottom_bun_name, bottom_bun->_dq);
-		bottom_bun->updateModel();
-		bottom_bun->positionInWorld(r_bottom_bun, "link6");
-		r_bottom_bun += bottom_bun_offset;
-
-		// write new robot state to redis
-		redis_client.setEigenMatrixJSON(JOINT_ANGLES_KEY, robot->_q);
-		redis_client.setEigenMatrixJSON(JOINT_VELOCITIES_KEY, robot->_dq);
-		redis_client.setEigenMatrixJSON(SPATULA_POSITION_KEY, r_spatula);
-		redis_client.setEigenMatrixJSON(SPATULA_ORIENTATION_KEY, ori_spatula);
-		redis_client.setEigenMatrixJSON(SPATULA_JOINT_ANGLES_KEY, spatula->_q);
-		redis_client.setEigenMatrixJSON(BURGER_POSITION_KEY, r_burger);
-		// redis_client.setEigenMatrixJSON(BURGER_ORIENTATION_KEY, q_burger);
-		// redis_client.setEigenMatrixJSON(BURGER_JOINT_ANGLES_KEY, burger->_q);
-		redis_client.setEigenMatrixJSON(TOMATO_POSITION_KEY, r_tomato);
-		redis_client.setEigenMatrixJSON(CHEESE_POSITION_KEY, r_cheese);
-		redis_client.setEigenMatrixJSON(LETTUCE_POSITION_KEY, r_lettuce);
-		redis_client.setEigenMatrixJSON(TOP_BUN_POSITION_KEY, r_top_bun);
-		redis_client.setEigenMatrixJSON(BOTTOM_BUN_POSITION_KEY, r_bottom_bun);
-
-		//update last time
-		last_time = curr_time;
+		{
+			TRACE_SCOPE("update robot");
+			sim->getJointPositions(robot_name, robot->_q);
+			sim->getJointVelocities(robot_name, robot->_dq);
+			robot->updateModel();
+		}
+
+		// object poses straight from the joint positions, no model update
+		// (body_pose.h). the object models only hold the joint positions
+		{
+			TRACE_SCOPE("update spatula");
+			sim->getJointPositions(spatula_name, spatula->_q);
+			bodyPosition(spatula->_q, spatula_offset, r_spatula);
+			bodyRotation(spatula->_q, ori_spatula_local);
+			ori_spatula = ori_spatula_local * spatula_rot_init;
+		}
+
+		// fastest joint and contacts of the spatula and the awake foods, for
+		// the next step size
+		double max_speed = robot->_dq.cwiseAbs().maxCoeff();
+		double max_contact_force = 0;
+		bool contact = false;
+
+		// the spatula always touches something, the fingers or the counter.
+		// only a change of its net contact force counts: the grip closing,
+		// the blade hitting the grill or taking the weight of a food. the
+		// blade on a food also shows up in the food's own contacts below
+		{
+			TRACE_SCOPE("spatula contacts");
+			Vector3d force = Vector3d::Zero();
+			for (const string& link : spatula_links)
+				force += bodyContactForce(sim, spatula_name, link, contact_points, contact_forces);
+			double load_change = (force - spatula_force).norm();
+			spatula_force = force;
+			if (load_change > step_params.load_change)
+			{
+				contact = true;
+				max_contact_force = max(max_contact_force, load_change);
+			}
+		}
+
+		{
+			TRACE_SCOPE("update foods");
+			for (int i = 0; i < foods.num_foods; i++)
+			{
+				BodySleep& sleep = food_sleep[i];
+				if (sleep.asleep())
+				{
+					if (foods.torque_applied[i])
+						sleep.wake();
+					else if (!sleep.pollDue(loop_dt, sleep_params))
+						continue;
+					else
+					{
+						sim->getJointVelocities(foods.names[i], food_dq);
+						Vector3d contact_force = bodyContactForce(sim, foods.names[i], "link6", contact_points, contact_forces);
+						if (!sleep.pollWake(food_dq, contact_force, sleep_params))
+							continue;
+					}
+				}
+
+				sim->getJointPositions(foods.names[i], food_q);
+				sim->getJointVelocities(foods.names[i], food_dq);
+				foods.q.col(i) = food_q;
+				Vector3d contact_force = bodyContactForce(sim, foods.names[i], "link6", contact_points, contact_forces);
+				max_speed = max(max_speed, food_dq.cwiseAbs().maxCoeff());
+				contact = contact || !contact_forces.empty();
+				for (const Vector3d& force : contact_forces)
+					max_contact_force = max(max_contact_force, force.norm());
+				if (sleep.update(food_dq, loop_dt, sleep_params))
+					sleep.setRestForce(contact_force);
+			}
+			// all food positions in one pass, sleeping foods keep their q
+			bodyPositions(foods.q, foods.offsets, foods.positions);
+		}
+		stepper.observe(contact, max_contact_force, max_speed, loop_dt, step_params);
+
+#ifndef HEADLESS
+		// hand the poses of this step to the render loop, never waits
+		PoseSnapshot& poses = pose_buffer.back();
+		poses.robot_q = robot->_q;
+		poses.spatula_q = spatula->_q;
+		poses.food_q = foods.q;
+		pose_buffer.publish();
+#endif
+
+		// write the new world state to redis as one record
+		world.seq++;
+		world.sim_time = restored_sim_time + sim_time;
+		world.dt = step_dt;
+#ifdef USING_LOCKSTEP
+		world.rtf = rtf_tuner.measured();
+#else
+		world.rtf = rtf_tuner.rtf();
+#endif
+		world.q = robot->_q;
+		world.dq = robot->_dq;
+		world.r_spatula = r_spatula;
+		world.ori_spatula = ori_spatula;
+		world.spatula_q = spatula->_q;
+		world.r_foods = foods.positions;
+		{
+			TRACE_SCOPE("publish world state");
+			packWorldState(world, world_state_buf);
+			transport.set(WORLD_STATE_KEY, world_state_buf, world.seq);
+			transport.flush();
+		}
+		publish_times[world.seq % num_publish_times] = chrono::steady_clock::now();
+
+		if (state_log.isOpen())
+		{
+			TRACE_SCOPE("record");
+			state_log.record(world, foods.q, command_torques, food_command_torques);
+		}
+
+		// the controller entered a new phase: snapshot of this step
+		if (checkpoint_dir != nullptr && unpackControllerCheckpoint(controller_state, controller_phase) &&
+			(controller_state.size() != checkpoint_controller_state.size() || controller_state != checkpoint_controller_state))
+		{
+			TRACE_SCOPE("write checkpoint");
+			checkpoint_controller_state = controller_state;
+			char name[80];
+			snprintf(name, sizeof(name), "/checkpoint_%03d_grill%d_plate%d_task%d.zck", num_checkpoints++,
+					 controller_phase.grill_index, controller_phase.plate_index, controller_phase.task);
+			saveCheckpoint(checkpoint_dir + string(name), robot, spatula, sim, world.sim_time, controller_state);
+		}
+
+		tuneRtf(timer.elapsedTime() - iteration_start, loop_dt, wall_dt);
+		loop_stats.loopEnd();
+		TRACE_DUMP_IF_REQUESTED(trace_file, "simviz");
 	}
 
-	double end_time = timer.elapsedTime() / slow_down_factor;
+#ifdef USING_LOCKSTEP
+	double wall_time = timer.elapsedTime();
+	std::cout << "\n";
+	std::cout << "Simulation Loop run time  : " << wall_time << " seconds (lockstep)\n";
+	std::cout << "Simulation Loop updates   : " << world.seq << "\n";
+	std::cout << "Simulated time            : " << world.sim_time << " seconds\n";
+	std::cout << "Real time factor          : " << world.sim_time / wall_time << "\n";
+#else
+	double end_time = timer.elapsedTime();
 	std::cout << "\n";
 	std::cout << "Simulation Loop run time  : " << end_time << " seconds\n";
 	std::cout << "Simulation Loop updates   : " << timer.elapsedCycles() << "\n";
 	std::cout << "Simulation Loop frequency : " << timer.elapsedCycles()/end_time << "Hz\n";
+	std::cout << "Simulated time            : " << sim_time << " seconds\n";
+	rtf_tuner.print();
+#endif
+	stepper.print(step_params);
+	if (latency_count > 0)
+	{
+		std::cout << "Sensor to torque latency  : " << 1e6 * latency_sum / latency_count << " us avg, "
+				  << 1e6 * latency_max << " us max (" << HotKeyTransport::name() << ")\n";
+	}
+	unsigned long long food_steps_asleep = 0, food_wakes = 0;
+	for (int i = 0; i < foods.num_foods; i++)
+	{
+		food_steps_asleep += food_sleep[i].stepsAsleep();
+		food_wakes += food_sleep[i].wakes();
+	}
+	if (world.seq > 0 && foods.num_foods > 0)
+	{
+		std::cout << "Food updates skipped      : " << 100.0 * food_steps_asleep / (foods.num_foods * world.seq)
+				  << " % (asleep), " << food_wakes << " wake ups\n";
+	}
+	loop_stats.print();
+	if (state_log.isOpen())
+	{
+		state_log.close();
+		state_log.print();
+	}
 }
 
 //------------------------------------------------------------------------------
 
+void replayPoses(const StateLog& log, size_t i, PoseSnapshot& poses)
+{
+	const StateLogLayout& layout = log.layout;
+	log.values(i, layout.q(), layout.dof, poses.robot_q);
+	log.values(i, layout.spatulaQ(), WORLD_STATE_SPATULA_DOF, poses.spatula_q);
+	if (poses.food_q.cols() != layout.num_foods)
+		poses.food_q.resize(6, layout.num_foods);
+	const float* values = log.values(i);
+	for (int f = 0; f < layout.num_foods; f++)
+		for (int k = 0; k < 6; k++)
+			poses.food_q(k, f) = values[layout.foodQ(f) + k];
+}
+
+//------------------------------------------------------------------------------
+
+bool restoreCheckpoint(const string& path, Simulation::Sai2Simulation* sim)
+{
+	Checkpoint checkpoint;
+	string reason;
+	if (!readCheckpoint(path, checkpoint, reason))
+	{
+		cout << "Checkpoint " << path << " " << reason << endl;
+		return false;
+	}
+
+	// every robot of the world must be in the checkpoint, with the same dof
+	vector<string> names = {robot_name, spatula_name};
+	names.insert(names.end(), foods.names.begin(), foods.names.end());
+	for (const string& name : names)
+	{
+		int i = checkpoint.index(name);
+		if (i < 0 || checkpoint.q[i].size() != (int) sim->dof(name))
+		{
+			cout << "Checkpoint " << path << " does not match " << world_file << ", "
+				 << (i < 0 ? "it has no " : "wrong dof for ") << name << endl;
+			return false;
+		}
+	}
+	for (const string& name : names)
+	{
+		int i = checkpoint.index(name);
+		sim->setJointPositions(name, checkpoint.q[i]);
+		sim->setJointVelocities(name, checkpoint.dq[i]);
+	}
+	for (int i = 0; i < foods.num_foods; i++)
+		foods.q.col(i) = checkpoint.q[checkpoint.index(foods.names[i])];
+	bodyPositions(foods.q, foods.offsets, foods.positions);
+
+	restored_sim_time = checkpoint.sim_time;
+	cout << "Restored checkpoint " << path << " at " << checkpoint.sim_time << " s of simulated time" << endl;
+	return true;
+}
+
+//------------------------------------------------------------------------------
+
+void saveCheckpoint(const string& path, Sai2Model::Sai2Model* robot, Sai2Model::Sai2Model* spatula,
+					Simulation::Sai2Simulation* sim, double sim_time, const VectorXd& controller_state)
+{
+	Checkpoint checkpoint;
+	checkpoint.sim_time = sim_time;
+	checkpoint.add(robot_name, robot->_q, robot->_dq);
+	// the loop only reads the spatula positions and skips sleeping foods
+	VectorXd dq = VectorXd::Zero(sim->dof(spatula_name));
+	sim->getJointVelocities(spatula_name, dq);
+	checkpoint.add(spatula_name, spatula->_q, dq);
+	for (int i = 0; i < foods.num_foods; i++)
+	{
+		VectorXd q = VectorXd::Zero(sim->dof(foods.names[i]));
+		dq = q;
+		sim->getJointPositions(foods.names[i], q);
+		sim->getJointVelocities(foods.names[i], dq);
+		checkpoint.add(foods.names[i], q, dq);
+	}
+	checkpoint.controller = controller_state;
+
+	if (writeCheckpoint(path, checkpoint))
+		cout << "Checkpoint " << path << " at " << sim_time << " s of simulated time" << endl;
+	else
+		cout << "Could not write checkpoint " << path << endl;
+}
+
+#ifndef HEADLESS
+//------------------------------------------------------------------------------
+
 void glfwError(int error, const char* description) {
 	cerr << "GLFW Error: " << description << endl;
 	exit(1);
@@ -629,6 +1167,49 @@ void keySelect(GLFWwindow* window, int key, int scancode, int action, int mods)
 		case GLFW_KEY_Z:
 			fTransZn = set;
 			break;
+		// replay controls, jumps repeat while the key is held
+		case GLFW_KEY_SPACE:
+			if (action == GLFW_PRESS)
+			{
+				fReplayPaused = !fReplayPaused;
+				fReplayStatus = true;
+			}
+			break;
+		case GLFW_KEY_RIGHT_BRACKET:
+			if (action == GLFW_PRESS)
+			{
+				replay_speed *= 2;
+				fReplayStatus = true;
+			}
+			break;
+		case GLFW_KEY_LEFT_BRACKET:
+			if (action == GLFW_PRESS)
+			{
+				replay_speed /= 2;
+				fReplayStatus = true;
+			}
+			break;
+		case GLFW_KEY_PERIOD:
+			if (set)
+			{
+				replay_jump += 5;
+				fReplayStatus = true;
+			}
+			break;
+		case GLFW_KEY_COMMA:
+			if (set)
+			{
+				replay_jump -= 5;
+				fReplayStatus = true;
+			}
+			break;
+		case GLFW_KEY_HOME:
+			if (action == GLFW_PRESS)
+			{
+				fReplayRestart = true;
+				fReplayStatus = true;
+			}
+			break;
 		default:
 			break;
 	}
@@ -662,4 +1243,4 @@ void mouseClick(GLFWwindow* window, int button, int action, int mods) {
 			break;
 	}
 }
-
+#endif
@@ -0,0 +1,151 @@
+#ifndef _STARTUP_LOADER_H
+#define _STARTUP_LOADER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Loads of the startup (urdf models, the graphics and the simulation world) on
+// a few worker threads, with a timeline of what was loaded when. add() queues a
+// load, wait() runs the queued loads on the workers and returns once all are
+// done: the barrier before the loops start. step() runs a load that depends on
+// others on the calling thread, so it shows up in the timeline too.
+//
+// The loads must be independent: each builds its own objects and only writes
+// its own result. An exception thrown by a load is rethrown by wait().
+//
+// ZOOM_CHEF_LOAD_THREADS sets the number of workers, 1 loads one after the
+// other. The default (or 0) is one per hardware thread.
+class StartupLoader
+{
+public:
+	StartupLoader(const char* variable = "ZOOM_CHEF_LOAD_THREADS")
+	{
+		_start = std::chrono::steady_clock::now();
+		const char* value = getenv(variable);
+		_threads = value == nullptr ? 0 : atoi(value);
+		if (_threads <= 0)
+			_threads = std::thread::hardware_concurrency();
+		_threads = std::max(1, _threads);
+	}
+
+	void add(const std::string& name, std::function<void()> load)
+	{
+		Load entry;
+		entry.name = name;
+		entry.run = load;
+		_loads.push_back(entry);
+	}
+
+	// run the loads added since the last wait, returns when they are all done
+	void wait()
+	{
+		size_t first = _waited;
+		_waited = _loads.size();
+		int workers = std::min<int>(_threads, _waited - first);
+		std::atomic<size_t> next(first);
+		std::vector<std::exception_ptr> errors(workers);
+		auto work = [&](int worker) {
+			size_t i;
+			while ((i = next++) < _waited)
+			{
+				try
+				{
+					run(_loads[i], worker + 1);
+				}
+				catch (...)
+				{
+					if (!errors[worker])
+						errors[worker] = std::current_exception();
+				}
+			}
+		};
+		std::vector<std::thread> threads;
+		for (int worker = 1; worker < workers; worker++)
+			threads.emplace_back(work, worker);
+		if (workers > 0)
+			work(0);
+		for (std::thread& thread : threads)
+			thread.join();
+		for (const std::exception_ptr& error : errors)
+			if (error)
+				std::rethrow_exception(error);
+	}
+
+	// run one load on the calling thread
+	void step(const std::string& name, std::function<void()> load)
+	{
+		wait();
+		add(name, load);
+		_waited = _loads.size();
+		run(_loads.back(), 0);
+	}
+
+	// one line per load: thread (0 is the calling thread for step()), start and
+	// duration in ms since the loader was made, and a bar on the total time
+	void print() const
+	{
+		double total = 0, busy = 0;
+		for (const Load& load : _loads)
+		{
+			total = std::max(total, load.end_ms);
+			busy += load.end_ms - load.start_ms;
+		}
+		printf("Startup timeline, %d load threads, %.0f ms (%.0f ms of loads):\n", _threads, total, busy);
+		const int width = 40;
+		for (const Load& load : _loads)
+		{
+			int from = total > 0 ? (int) (width * load.start_ms / total) : 0;
+			int to = total > 0 ? std::max(from + 1, (int) (width * load.end_ms / total)) : 1;
+			std::string bar(width, ' ');
+			std::fill(bar.begin() + from, bar.begin() + std::min(to, width), '#');
+			printf("  %-28s %2d %8.1f %8.1f  |%s|\n", load.name.c_str(), load.thread, load.start_ms,
+				   load.end_ms - load.start_ms, bar.c_str());
+		}
+	}
+
+private:
+	struct Load
+	{
+		std::string name;
+		std::function<void()> run;
+		int thread = 0;
+		double start_ms = 0;
+		double end_ms = 0;
+	};
+
+	void run(Load& load, int thread)
+	{
+		load.thread = thread;
+		load.start_ms = elapsedMs();
+		try
+		{
+			load.run();
+		}
+		catch (...)
+		{
+			load.end_ms = elapsedMs();
+			throw;
+		}
+		load.end_ms = elapsedMs();
+	}
+
+	double elapsedMs() const
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _start).count();
+	}
+
+	std::chrono::steady_clock::time_point _start;
+	int _threads;
+	std::vector<Load> _loads;
+	size_t _waited = 0;
+};
+
+#endif
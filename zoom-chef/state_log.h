@@ -0,0 +1,500 @@
+#ifndef _STATE_LOG_H
+#define _STATE_LOG_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Eigen/Dense>
+
+#include "trace.h"
+#include "world_state.h"
+
+// Log of a simulation run, one record per published world state, written by
+// simviz with ZOOM_CHEF_RECORD and replayed with ZOOM_CHEF_REPLAY. A world
+// state is published once per simulation loop iteration, after all physics
+// steps of the iteration (up to max_steps of adaptive_step.h), so a record
+// covers one or more steps. A .zcl file is
+//
+//   StateLogHeader
+//   char            names[names_size]     food names, each ending in '\0',
+//                                         zero padded to a multiple of 8
+//   chunks, each:   StateLogChunk, then num_records records
+//
+// and a record is
+//
+//   uint64 seq, double sim_time, then float values:
+//   [ q (dof) | dq (dof) | spatula_q (6) | food q (6 * num_foods) |
+//     joint torques commanded (dof) | food torques commanded (6 * num_foods) ]
+//
+// with the foods in the column order of the food table (scene.h) and the
+// torques that were applied during the steps of the iteration. Every chunk but the last holds
+// chunk_capacity records. Chunks are written whole by a writer thread, so a
+// log cut short by a crash ends with its last complete chunk.
+
+constexpr uint32_t STATE_LOG_VERSION = 2;
+constexpr uint32_t STATE_LOG_CHUNK_MAGIC = 0x6b6e6863;  // "chnk"
+
+struct StateLogHeader
+{
+	char magic[8];            // "ZCLOG"
+	uint32_t version;
+	uint32_t dof;
+	uint32_t num_foods;
+	uint32_t num_values;      // floats per record
+	uint32_t chunk_capacity;  // records per chunk
+	uint32_t names_size;
+	char reserved[32];
+};
+
+struct StateLogChunk
+{
+	uint32_t magic;
+	uint32_t num_records;
+	uint64_t first_seq;
+	double first_sim_time;
+	double last_sim_time;
+	double wall_time;         // seconds since the recording started, at the first record
+	uint64_t data_hash;       // FNV-1a of the records
+};
+
+static_assert(sizeof(StateLogHeader) == 64, "state log header layout");
+static_assert(sizeof(StateLogChunk) == 48, "state log chunk layout");
+
+inline int stateLogValues(int dof, int num_foods)
+{
+	return 3 * dof + WORLD_STATE_SPATULA_DOF + 12 * num_foods;
+}
+
+inline uint64_t stateLogHash(const char* data, size_t size)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ (unsigned char) data[i]) * 1099511628211ULL;
+	return hash;
+}
+
+// offsets of the parts of a record in its float values
+struct StateLogLayout
+{
+	int dof = 0;
+	int num_foods = 0;
+
+	int q() const { return 0; }
+	int dq() const { return dof; }
+	int spatulaQ() const { return 2 * dof; }
+	int foodQ(int food) const { return 2 * dof + WORLD_STATE_SPATULA_DOF + 6 * food; }
+	int torques() const { return 2 * dof + WORLD_STATE_SPATULA_DOF + 6 * num_foods; }
+	int foodTorques() const { return 3 * dof + WORLD_STATE_SPATULA_DOF + 6 * num_foods; }
+	size_t recordSize() const
+	{
+		return sizeof(uint64_t) + sizeof(double) + stateLogValues(dof, num_foods) * sizeof(float);
+	}
+};
+
+// Recording side. record() only copies the step into the current chunk. Full
+// chunks go to a writer thread, so the simulation loop never waits for the
+// disk. open() allocates all chunk buffers up front, max_chunks_queued for
+// the writer and one being filled, so recording never allocates. If the disk
+// falls max_chunks_queued chunks behind, chunks are dropped and counted
+// instead.
+class StateLogWriter
+{
+public:
+	StateLogWriter() {}
+	StateLogWriter(const StateLogWriter&) = delete;
+	StateLogWriter& operator=(const StateLogWriter&) = delete;
+	~StateLogWriter() { close(); }
+
+	bool open(const std::string& path, int dof, const std::vector<std::string>& food_names,
+			  int chunk_capacity = 1000, int max_chunks_queued = 16)
+	{
+		close();
+		_file = fopen(path.c_str(), "wb");
+		if (_file == nullptr)
+		{
+			std::cout << "Could not open " << path << " to record the simulation" << std::endl;
+			return false;
+		}
+		_path = path;
+		_layout.dof = dof;
+		_layout.num_foods = food_names.size();
+		_chunk_capacity = chunk_capacity;
+		_chunk_size = sizeof(StateLogChunk) + chunk_capacity * _layout.recordSize();
+
+		std::string names;
+		for (const std::string& name : food_names)
+			names += name + '\0';
+		// the floats of the first chunk stay aligned in the mapped log
+		names.resize((names.size() + 7) / 8 * 8, '\0');
+		StateLogHeader header;
+		memset(&header, 0, sizeof(header));
+		strncpy(header.magic, "ZCLOG", sizeof(header.magic));
+		header.version = STATE_LOG_VERSION;
+		header.dof = dof;
+		header.num_foods = _layout.num_foods;
+		header.num_values = stateLogValues(dof, _layout.num_foods);
+		header.chunk_capacity = chunk_capacity;
+		header.names_size = names.size();
+		fwrite(&header, sizeof(header), 1, _file);
+		fwrite(names.data(), 1, names.size(), _file);
+		_bytes = sizeof(header) + names.size();
+
+		// written to, so the pages are mapped before the simulation starts
+		_free.clear();
+		for (int i = 0; i < max_chunks_queued + 1; i++)
+			_free.push_back(std::vector<char>(_chunk_size));
+		_queued.clear();
+		_queued.reserve(max_chunks_queued + 1);
+		_current = takeBuffer();
+		_start = std::chrono::steady_clock::now();
+		_running = true;
+		_thread = std::thread(&StateLogWriter::run, this);
+		return true;
+	}
+
+	bool isOpen() const { return _file != nullptr; }
+
+	// one loop iteration: the world state published after its physics steps,
+	// the food joint positions and the torques applied during them
+	void record(const WorldState& world, const Eigen::Matrix<double, 6, Eigen::Dynamic>& food_q,
+				const Eigen::VectorXd& torques, const Eigen::VectorXd& food_torques)
+	{
+		if (_file == nullptr)
+			return;
+		if (_current.empty())
+		{
+			// the writer is too far behind, this chunk is dropped
+			_records_dropped++;
+			if (++_current_records == _chunk_capacity)
+			{
+				_current_records = 0;
+				_current = takeBuffer();
+			}
+			return;
+		}
+
+		StateLogChunk* chunk = (StateLogChunk*) _current.data();
+		if (_current_records == 0)
+		{
+			chunk->first_seq = world.seq;
+			chunk->first_sim_time = world.sim_time;
+			chunk->wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+		}
+		chunk->last_sim_time = world.sim_time;
+
+		char* record = _current.data() + sizeof(StateLogChunk) + _current_records * _layout.recordSize();
+		uint64_t seq = world.seq;
+		memcpy(record, &seq, sizeof(seq));
+		memcpy(record + sizeof(seq), &world.sim_time, sizeof(double));
+		float* values = (float*) (record + sizeof(seq) + sizeof(double));
+		const int dof = _layout.dof;
+		for (int i = 0; i < dof; i++)
+		{
+			values[_layout.q() + i] = world.q(i);
+			values[_layout.dq() + i] = world.dq(i);
+			values[_layout.torques() + i] = i < torques.size() ? torques(i) : 0;
+		}
+		for (int i = 0; i < WORLD_STATE_SPATULA_DOF; i++)
+			values[_layout.spatulaQ() + i] = world.spatula_q(i);
+		for (int f = 0; f < _layout.num_foods; f++)
+			for (int i = 0; i < 6; i++)
+			{
+				values[_layout.foodQ(f) + i] = food_q(i, f);
+				values[_layout.foodTorques() + 6 * f + i] = 6 * f + i < food_torques.size() ? food_torques(6 * f + i) : 0;
+			}
+
+		if (++_current_records == _chunk_capacity)
+			queueChunk();
+	}
+
+	// write the last chunk and wait until everything is on disk
+	void close()
+	{
+		if (_file == nullptr)
+			return;
+		if (_current_records > 0 && !_current.empty())
+			queueChunk();
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_running = false;
+		}
+		_wake.notify_one();
+		if (_thread.joinable())
+			_thread.join();
+		fclose(_file);
+		_file = nullptr;
+	}
+
+	void print() const
+	{
+		std::cout << "Recorded                  : " << _records_written << " records in " << _chunks_written
+				  << " chunks, " << _bytes / (1024.0 * 1024.0) << " MB to " << _path;
+		if (_records_dropped > 0)
+			std::cout << ", " << _records_dropped << " records dropped (disk too slow)";
+		std::cout << "\n";
+	}
+
+private:
+	// a buffer of the free list, empty when they are all waiting for the
+	// writer
+	std::vector<char> takeBuffer()
+	{
+		std::vector<char> buffer;
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (!_free.empty())
+		{
+			buffer.swap(_free.back());
+			_free.pop_back();
+		}
+		return buffer;
+	}
+
+	void queueChunk()
+	{
+		StateLogChunk* chunk = (StateLogChunk*) _current.data();
+		chunk->magic = STATE_LOG_CHUNK_MAGIC;
+		chunk->num_records = _current_records;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_queued.push_back(std::vector<char>());
+			_queued.back().swap(_current);
+		}
+		_wake.notify_one();
+		_current_records = 0;
+		_current = takeBuffer();
+	}
+
+	void run()
+	{
+		TRACE_THREAD_NAME("state log");
+		std::unique_lock<std::mutex> lock(_mutex);
+		while (true)
+		{
+			_wake.wait(lock, [this] { return !_queued.empty() || !_running; });
+			if (_queued.empty())
+				break;
+			std::vector<char> buffer;
+			buffer.swap(_queued.front());
+			_queued.erase(_queued.begin());
+			lock.unlock();
+
+			// the hash and the disk write are off the simulation thread
+			StateLogChunk* chunk = (StateLogChunk*) buffer.data();
+			size_t data_size = chunk->num_records * _layout.recordSize();
+			chunk->data_hash = stateLogHash(buffer.data() + sizeof(StateLogChunk), data_size);
+			fwrite(buffer.data(), 1, sizeof(StateLogChunk) + data_size, _file);
+			_bytes += sizeof(StateLogChunk) + data_size;
+			_records_written += chunk->num_records;
+			_chunks_written++;
+
+			lock.lock();
+			_free.push_back(std::vector<char>());
+			_free.back().swap(buffer);
+		}
+	}
+
+	FILE* _file = nullptr;
+	std::string _path;
+	StateLogLayout _layout;
+	int _chunk_capacity = 0;
+	size_t _chunk_size = 0;
+	std::chrono::steady_clock::time_point _start;
+
+	// simulation thread
+	std::vector<char> _current;
+	int _current_records = 0;
+	unsigned long long _records_dropped = 0;
+
+	// shared with the writer thread
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::vector<std::vector<char> > _queued;  // oldest first, reserved by open()
+	std::vector<std::vector<char> > _free;
+	bool _running = false;
+	std::thread _thread;
+
+	// writer thread, read after close()
+	unsigned long long _records_written = 0;
+	unsigned long long _chunks_written = 0;
+	size_t _bytes = 0;
+};
+
+// Replay side: the log memory mapped, with the records of all chunks under one
+// index sorted by simulated time.
+class StateLog
+{
+public:
+	StateLog() {}
+	StateLog(const StateLog&) = delete;
+	StateLog& operator=(const StateLog&) = delete;
+	~StateLog() { unmap(); }
+
+	StateLogLayout layout;
+	std::vector<std::string> food_names;
+
+	// map a log. chunks after the first incomplete or corrupt one are left out
+	// and reported in reason, which is empty if the whole log was read
+	bool map(const std::string& path, std::string& reason)
+	{
+		unmap();
+		reason.clear();
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			reason = "cannot be opened";
+			return false;
+		}
+		struct stat info;
+		void* data = MAP_FAILED;
+		if (fstat(fd, &info) == 0 && info.st_size >= (off_t) sizeof(StateLogHeader))
+			data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (data == MAP_FAILED)
+		{
+			reason = "is too small";
+			return false;
+		}
+		_map = (const char*) data;
+		_map_size = info.st_size;
+
+		const StateLogHeader* header = (const StateLogHeader*) _map;
+		layout.dof = header->dof;
+		layout.num_foods = header->num_foods;
+		if (strncmp(header->magic, "ZCLOG", sizeof(header->magic)) != 0 || header->version != STATE_LOG_VERSION ||
+			header->num_values != (uint32_t) stateLogValues(layout.dof, layout.num_foods) || header->names_size % 8 != 0)
+		{
+			reason = "is not a version " + std::to_string(STATE_LOG_VERSION) + " state log";
+			unmap();
+			return false;
+		}
+		size_t offset = sizeof(StateLogHeader);
+		if (offset + header->names_size > _map_size)
+		{
+			reason = "is truncated";
+			unmap();
+			return false;
+		}
+		const char* name = _map + offset;
+		const char* names_end = name + header->names_size;
+		while (name < names_end && *name != '\0')
+		{
+			food_names.push_back(std::string(name));
+			name += food_names.back().size() + 1;
+		}
+		offset += header->names_size;
+
+		// a record is a multiple of 4 bytes, not of 8, so chunk headers are
+		// copied out instead of read in place
+		const size_t record_size = layout.recordSize();
+		while (offset < _map_size)
+		{
+			StateLogChunk chunk;
+			const char* records = _map + offset + sizeof(StateLogChunk);
+			if (offset + sizeof(StateLogChunk) <= _map_size)
+				memcpy(&chunk, _map + offset, sizeof(chunk));
+			if (offset + sizeof(StateLogChunk) > _map_size || chunk.magic != STATE_LOG_CHUNK_MAGIC ||
+				offset + sizeof(StateLogChunk) + chunk.num_records * record_size > _map_size)
+			{
+				reason = "is truncated after " + std::to_string(_records.size()) + " records";
+				break;
+			}
+			if (stateLogHash(records, chunk.num_records * record_size) != chunk.data_hash)
+			{
+				reason = "has a corrupt chunk after " + std::to_string(_records.size()) + " records";
+				break;
+			}
+			for (uint32_t i = 0; i < chunk.num_records; i++)
+				_records.push_back(records + i * record_size);
+			_chunks++;
+			offset += sizeof(StateLogChunk) + chunk.num_records * record_size;
+		}
+		if (_records.empty())
+		{
+			if (reason.empty())
+				reason = "has no records";
+			unmap();
+			return false;
+		}
+		return true;
+	}
+
+	size_t size() const { return _records.size(); }
+	size_t chunks() const { return _chunks; }
+
+	uint64_t seq(size_t i) const
+	{
+		uint64_t value;
+		memcpy(&value, _records[i], sizeof(value));
+		return value;
+	}
+
+	double simTime(size_t i) const
+	{
+		double value;
+		memcpy(&value, _records[i] + sizeof(uint64_t), sizeof(value));
+		return value;
+	}
+
+	const float* values(size_t i) const { return (const float*) (_records[i] + sizeof(uint64_t) + sizeof(double)); }
+
+	double startTime() const { return simTime(0); }
+	double endTime() const { return simTime(size() - 1); }
+
+	// last record at or before time, the first one before the start
+	size_t find(double time) const
+	{
+		size_t low = 0, high = size();
+		while (high - low > 1)
+		{
+			size_t middle = (low + high) / 2;
+			if (simTime(middle) <= time)
+				low = middle;
+			else
+				high = middle;
+		}
+		return low;
+	}
+
+	// part of record i as a vector, e.g. values(i, layout.q(), layout.dof)
+	void values(size_t i, int offset, int count, Eigen::VectorXd& out) const
+	{
+		const float* v = values(i) + offset;
+		if (out.size() != count)
+			out.resize(count);
+		for (int k = 0; k < count; k++)
+			out(k) = v[k];
+	}
+
+private:
+	void unmap()
+	{
+		if (_map != nullptr)
+			munmap((void*) _map, _map_size);
+		_map = nullptr;
+		_map_size = 0;
+		_records.clear();
+		_chunks = 0;
+		food_names.clear();
+	}
+
+	const char* _map = nullptr;
+	size_t _map_size = 0;
+	std::vector<const char*> _records;
+	size_t _chunks = 0;
+};
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+// Scoped trace points for the zoom-chef loops, exported as Chrome trace_event
+// JSON (open in chrome://tracing or https://ui.perfetto.dev).
+//
+//   TRACE_SCOPE("integrate");   // records from here to the end of the scope
+//
+// Every thread writes its events into its own ring buffer (the newest
+// TRACE_RING_SIZE events are kept) without locks or allocation. traceDump()
+// writes all rings to a file, the loops call traceDumpIfRequested() every tick
+// so that `kill -USR1 <pid>` dumps a running process.
+//
+// Only compiled in with USING_TRACE (cmake -DZOOM_CHEF_TRACE=ON), otherwise the
+// macros do nothing.
+
+#ifdef USING_TRACE
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include <signal.h>
+#include <unistd.h>
+
+constexpr int TRACE_RING_SIZE = 1 << 16;
+constexpr int TRACE_MAX_THREADS = 16;
+
+struct TraceEvent
+{
+	const char* name;  // string literal
+	int64_t start_ns;
+	int64_t duration_ns;
+};
+
+struct TraceRing
+{
+	const char* thread_name = "thread";
+	int tid = 0;
+	std::atomic<uint64_t> head{0};  // events written so far
+	TraceEvent events[TRACE_RING_SIZE];
+};
+
+// state shared by all threads of the process
+struct TraceState
+{
+	std::atomic<int> num_rings{0};
+	TraceRing* rings[TRACE_MAX_THREADS] = {};
+	std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+	volatile sig_atomic_t dump_requested = 0;
+};
+
+inline TraceState& traceState()
+{
+	static TraceState state;
+	return state;
+}
+
+inline int64_t traceNow()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceState().epoch).count();
+}
+
+// ring of the calling thread, registered on first use. nullptr when more than
+// TRACE_MAX_THREADS threads trace
+inline TraceRing* traceRing()
+{
+	static thread_local TraceRing* ring = nullptr;
+	static thread_local bool registered = false;
+	if (!registered)
+	{
+		registered = true;
+		TraceState& state = traceState();
+		int index = state.num_rings.load();
+		while (index < TRACE_MAX_THREADS && !state.num_rings.compare_exchange_weak(index, index + 1))
+			;
+		if (index < TRACE_MAX_THREADS)
+		{
+			ring = new TraceRing();
+			ring->tid = index + 1;
+			state.rings[index] = ring;
+		}
+	}
+	return ring;
+}
+
+// name shown for the calling thread in the trace (string literal)
+inline void traceThreadName(const char* name)
+{
+	if (TraceRing* ring = traceRing())
+		ring->thread_name = name;
+}
+
+class TraceScope
+{
+public:
+	TraceScope(const char* name) : _name(name), _start(traceNow()) {}
+
+	~TraceScope()
+	{
+		TraceRing* ring = traceRing();
+		if (ring == nullptr)
+			return;
+		uint64_t head = ring->head.load(std::memory_order_relaxed);
+		TraceEvent& event = ring->events[head % TRACE_RING_SIZE];
+		event.name = _name;
+		event.start_ns = _start;
+		event.duration_ns = traceNow() - _start;
+		ring->head.store(head + 1, std::memory_order_release);
+	}
+
+private:
+	const char* _name;
+	int64_t _start;
+};
+
+// write all rings as Chrome trace JSON. events that are overwritten while the
+// dump runs may come out garbled, dump from the loop thread to avoid that
+inline bool traceDump(const std::string& path, const char* process_name)
+{
+	FILE* file = fopen(path.c_str(), "w");
+	if (file == nullptr)
+		return false;
+	int pid = getpid();
+	fprintf(file, "{\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}", pid, process_name);
+
+	TraceState& state = traceState();
+	int num_rings = std::min(state.num_rings.load(), TRACE_MAX_THREADS);
+	for (int r = 0; r < num_rings; r++)
+	{
+		TraceRing* ring = state.rings[r];
+		if (ring == nullptr)
+			continue;
+		fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+				pid, ring->tid, ring->thread_name);
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		uint64_t first = head > (uint64_t) TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+		for (uint64_t i = first; i < head; i++)
+		{
+			const TraceEvent& event = ring->events[i % TRACE_RING_SIZE];
+			fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+					event.name, pid, ring->tid, event.start_ns * 1e-3, event.duration_ns * 1e-3);
+		}
+	}
+	fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	fclose(file);
+	printf("Trace written to %s\n", path.c_str());
+	return true;
+}
+
+inline void traceSignalHandler(int)
+{
+	traceState().dump_requested = 1;
+}
+
+// dump on SIGUSR1
+inline void traceInstallSignalHandler()
+{
+	signal(SIGUSR1, &traceSignalHandler);
+}
+
+inline void traceDumpIfRequested(const std::string& path, const char* process_name)
+{
+	if (!traceState().dump_requested)
+		return;
+	traceState().dump_requested = 0;
+	traceDump(path, process_name);
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(_trace_scope_, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) traceThreadName(name)
+#define TRACE_INSTALL_SIGNAL_HANDLER() traceInstallSignalHandler()
+#define TRACE_DUMP(path, process_name) traceDump(path, process_name)
+#define TRACE_DUMP_IF_REQUESTED(path, process_name) traceDumpIfRequested(path, process_name)
+
+#else
+
+#define TRACE_SCOPE(name)
+#define TRACE_THREAD_NAME(name)
+#define TRACE_INSTALL_SIGNAL_HANDLER()
+#define TRACE_DUMP(path, process_name)
+#define TRACE_DUMP_IF_REQUESTED(path, process_name)
+
+#endif
+
+#endif
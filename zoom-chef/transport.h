@@ -0,0 +1,159 @@
+#ifndef _TRANSPORT_H
+#define _TRANSPORT_H
+
+#include <string>
+
+#include <Eigen/Dense>
+#include <hiredis/hiredis.h>
+#include "redis/RedisClient.h"
+
+#include "keys.h"
+#include "redis_binary.h"
+#include "shm_transport.h"
+
+// Moves the hot keys of keys.h between simviz and the controller. The backend
+// is picked at build time and must match in both executables:
+//   default                   redis, JSON text (setEigenMatrixJSON format)
+//   ZOOM_CHEF_BINARY_REDIS    redis, binary format of redis_binary.h
+//   ZOOM_CHEF_SHM_TRANSPORT   shared memory slots of shm_transport.h, no redis
+//
+// set() only queues a value, flush() sends everything queued so far in one
+// round trip. get()/getMany() return right away with the latest value.
+class HotKeyTransport
+{
+public:
+	HotKeyTransport(RedisClient& redis_client) : _redis_client(redis_client) {}
+
+	// the simulation creates the transport, the controller attaches to it
+	bool open(bool create)
+	{
+#ifdef USING_SHM_TRANSPORT
+		return _shm.open(create);
+#else
+		return true;
+#endif
+	}
+
+	static const char* name()
+	{
+#if defined(USING_SHM_TRANSPORT)
+		return "shared memory";
+#elif defined(USING_BINARY_REDIS)
+		return "redis (binary)";
+#else
+		return "redis (json)";
+#endif
+	}
+
+	template<typename Derived>
+	void set(const std::string& key, const Eigen::MatrixBase<Derived>& value, uint64_t seq = 0)
+	{
+#if defined(USING_SHM_TRANSPORT)
+		_shm.write(ShmSegment::slotIndex(key), value, seq);
+#elif defined(USING_BINARY_REDIS)
+		appendSetEigenBinary(_redis_client, key, value, seq, _buf);
+		_queued++;
+#else
+		_buf = RedisClient::encodeEigenMatrixJSON(value);
+		redisAppendCommand(_redis_client.context_, "SET %s %s", key.c_str(), _buf.c_str());
+		_queued++;
+#endif
+	}
+
+	void flush()
+	{
+		if (_queued == 0)
+			return;
+		readPipelinedReplies(_redis_client, _queued);
+		_queued = 0;
+		round_trips++;
+	}
+
+	// latest value of key. seq is only carried by the binary and shared memory
+	// backends and is 0 otherwise
+	template<typename Derived>
+	bool get(const std::string& key, Eigen::PlainObjectBase<Derived>& value, uint64_t* seq = nullptr)
+	{
+#if defined(USING_SHM_TRANSPORT)
+		return _shm.read(ShmSegment::slotIndex(key), value, seq);
+#elif defined(USING_BINARY_REDIS)
+		round_trips++;
+		return getEigenBinary(_redis_client, key, value, seq);
+#else
+		round_trips++;
+		redisReply* reply = (redisReply*) redisCommand(_redis_client.context_, "GET %s", key.c_str());
+		if (reply == nullptr)
+			return false;
+		bool ok = reply->type == REDIS_REPLY_STRING;
+		if (ok)
+		{
+			value = RedisClient::decodeEigenMatrixJSON(std::string(reply->str, reply->len));
+			if (seq != nullptr)
+				*seq = 0;
+		}
+		freeReplyObject(reply);
+		return ok;
+#endif
+	}
+
+	// get several keys in one round trip. returns the number of keys read
+	int getMany(const char* const keys[], Eigen::VectorXd* const values[], int num_keys, uint64_t* seqs = nullptr)
+	{
+#if defined(USING_SHM_TRANSPORT)
+		int num_read = 0;
+		for (int i = 0; i < num_keys; i++)
+			if (_shm.read(ShmSegment::slotIndex(keys[i]), *values[i], seqs ? &seqs[i] : nullptr))
+				num_read++;
+		return num_read;
+#else
+		round_trips++;
+		for (int i = 0; i < num_keys; i++)
+			redisAppendCommand(_redis_client.context_, "GET %s", keys[i]);
+
+		int num_read = 0;
+		for (int i = 0; i < num_keys; i++)
+		{
+			redisReply* reply = nullptr;
+			if (redisGetReply(_redis_client.context_, (void**) &reply) != REDIS_OK)
+				break;
+			if (reply->type == REDIS_REPLY_STRING)
+			{
+#ifdef USING_BINARY_REDIS
+				if (decodeEigenBinary(reply->str, reply->len, *values[i], seqs ? &seqs[i] : nullptr))
+					num_read++;
+#else
+				*values[i] = RedisClient::decodeEigenMatrixJSON(std::string(reply->str, reply->len));
+				if (seqs != nullptr)
+					seqs[i] = 0;
+				num_read++;
+#endif
+			}
+			freeReplyObject(reply);
+		}
+		return num_read;
+#endif
+	}
+
+	// true if the other process stopped writing key, see
+	// ShmSegment::writerStalled. redis keeps no write times, so the redis
+	// backends never report a stall
+	bool writerStalled(const std::string& key) const
+	{
+#ifdef USING_SHM_TRANSPORT
+		return _shm.writerStalled(ShmSegment::slotIndex(key));
+#else
+		return false;
+#endif
+	}
+
+	// redis round trips since startup
+	unsigned long long round_trips = 0;
+
+private:
+	RedisClient& _redis_client;
+	ShmSegment _shm;
+	std::string _buf;
+	int _queued = 0;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef _TRIPLE_BUFFER_H
+#define _TRIPLE_BUFFER_H
+
+#include <atomic>
+
+// Lock-free handoff of the latest value from one writer thread to one reader
+// thread. There are three slots: the writer fills the back slot and swaps it
+// with the middle one, the reader swaps the middle slot with its front slot
+// when the writer left something new there. Neither side ever waits, and the
+// reader always gets the newest complete value (older ones are dropped).
+//
+// T is copied into the slots with operator=, so Eigen types sized once with
+// init() are handed over without allocating.
+template<typename T>
+class TripleBuffer
+{
+public:
+	// set all three slots, before the threads start
+	void init(const T& value)
+	{
+		for (int i = 0; i < 3; i++)
+			_slots[i].value = value;
+	}
+
+	// writer: slot to fill, then publish() it
+	T& back() { return _slots[_back].value; }
+
+	void publish()
+	{
+		int previous = _middle.exchange(_back | NEW_VALUE, std::memory_order_acq_rel);
+		_back = previous & SLOT_MASK;
+	}
+
+	// reader: take the newest published value into front(). returns false if
+	// nothing new was published since the last call
+	bool update()
+	{
+		if (!(_middle.load(std::memory_order_relaxed) & NEW_VALUE))
+			return false;
+		int previous = _middle.exchange(_front, std::memory_order_acq_rel);
+		_front = previous & SLOT_MASK;
+		return true;
+	}
+
+	const T& front() const { return _slots[_front].value; }
+
+private:
+	static constexpr int SLOT_MASK = 3;
+	static constexpr int NEW_VALUE = 4;
+
+	struct alignas(64) Slot
+	{
+		T value;
+	};
+
+	Slot _slots[3];
+	alignas(64) std::atomic<int> _middle{1};
+	alignas(64) int _back = 2;   // writer only
+	alignas(64) int _front = 0;  // reader only
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef _WORLD_STATE_H
+#define _WORLD_STATE_H
+
+#include <Eigen/Dense>
+
+// Snapshot of everything the controller needs from the simulation, taken
+// right after one sim->integrate. simviz packs it into a single flat vector
+// and publishes it under WORLD_STATE_KEY, so a reader always gets robot and
+// object state from the same physics step.
+//
+// layout:
+//   [ seq, sim_time, dt, dof, num_foods, rtf | q (dof) | dq (dof) | r_spatula (3) |
+//     ori_spatula (9, column major) | spatula_q (6) |
+//     r_foods (3 * num_foods, one food after the other) ]
+//
+// foods are in the column order of the food table (scene.h).
+
+constexpr int WORLD_STATE_HEADER_SIZE = 6;
+constexpr int WORLD_STATE_SPATULA_DOF = 6;
+
+struct WorldState
+{
+	unsigned long long seq = 0;  // publish counter, increases by one per simulation loop iteration
+	double sim_time = 0;         // simulated time in seconds
+	double dt = 0;               // physics step size of the last iteration in seconds, see adaptive_step.h
+	double rtf = 0;              // simulated seconds per wall second, see rtf_tuner.h
+
+	Eigen::VectorXd q;
+	Eigen::VectorXd dq;
+	Eigen::Vector3d r_spatula = Eigen::Vector3d::Zero();
+	Eigen::Matrix3d ori_spatula = Eigen::Matrix3d::Identity();
+	Eigen::VectorXd spatula_q = Eigen::VectorXd::Zero(WORLD_STATE_SPATULA_DOF);
+	Eigen::Matrix3Xd r_foods;    // position of food i in column i
+};
+
+inline int worldStateSize(int dof, int num_foods)
+{
+	return WORLD_STATE_HEADER_SIZE + 2 * dof + 3 + 9 + WORLD_STATE_SPATULA_DOF + 3 * num_foods;
+}
+
+// pack the world state into buf. buf is only resized when the robot dof or
+// the number of foods change
+inline void packWorldState(const WorldState& world, Eigen::VectorXd& buf)
+{
+	const int dof = world.q.size();
+	const int num_foods = world.r_foods.cols();
+	if (buf.size() != worldStateSize(dof, num_foods))
+		buf.resize(worldStateSize(dof, num_foods));
+
+	int i = 0;
+	buf(i++) = (double) world.seq;
+	buf(i++) = world.sim_time;
+	buf(i++) = world.dt;
+	buf(i++) = dof;
+	buf(i++) = num_foods;
+	buf(i++) = world.rtf;
+	buf.segment(i, dof) = world.q; i += dof;
+	buf.segment(i, dof) = world.dq; i += dof;
+	buf.segment<3>(i) = world.r_spatula; i += 3;
+	buf.segment<9>(i) = Eigen::Map<const Eigen::Matrix<double, 9, 1> >(world.ori_spatula.data()); i += 9;
+	buf.segment(i, WORLD_STATE_SPATULA_DOF) = world.spatula_q; i += WORLD_STATE_SPATULA_DOF;
+	buf.segment(i, 3 * num_foods) = Eigen::Map<const Eigen::VectorXd>(world.r_foods.data(), 3 * num_foods);
+}
+
+// unpack buf into world. returns false and leaves world untouched if buf is
+// not a complete world state record
+inline bool unpackWorldState(const Eigen::VectorXd& buf, WorldState& world)
+{
+	if (buf.size() < WORLD_STATE_HEADER_SIZE)
+		return false;
+	const int dof = (int) buf(3);
+	const int num_foods = (int) buf(4);
+	if (dof < 0 || num_foods < 0 || buf.size() != worldStateSize(dof, num_foods))
+		return false;
+
+	int i = 0;
+	world.seq = (unsigned long long) buf(i++);
+	world.sim_time = buf(i++);
+	world.dt = buf(i++);
+	i += 2;
+	world.rtf = buf(i++);
+	world.q = buf.segment(i, dof); i += dof;
+	world.dq = buf.segment(i, dof); i += dof;
+	world.r_spatula = buf.segment<3>(i); i += 3;
+	Eigen::Map<Eigen::Matrix<double, 9, 1> >(world.ori_spatula.data()) = buf.segment<9>(i); i += 9;
+	world.spatula_q = buf.segment(i, WORLD_STATE_SPATULA_DOF); i += WORLD_STATE_SPATULA_DOF;
+	if (world.r_foods.cols() != num_foods)
+		world.r_foods.resize(3, num_foods);
+	Eigen::Map<Eigen::VectorXd>(world.r_foods.data(), 3 * num_foods) = buf.segment(i, 3 * num_foods);
+	return true;
+}
+
+#endif